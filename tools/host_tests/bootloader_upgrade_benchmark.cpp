@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) 2026 Zubax, zubax.com
+ * Distributed under the MIT License, available in the file LICENSE.
+ * Author: Pavel Kirienko <pavel.kirienko@zubax.com>
+ */
+
+/*
+ * Cost of Bootloader::upgradeApp() on the simulated flash of STM32F105, with the application verified in the
+ * download stream or read back from the storage, depending on BOOTLOADER_READBACK_VERIFY; see run.sh.
+ * The images are downloaded in chunks of random sizes, so that the descriptor is split between the chunks in
+ * different ways; the verification must find the valid application, reject the corrupted one, and skip the
+ * signature that does not start a valid descriptor.
+ */
+
+#include <zubax_chibios/platform/host/storage_backends.hpp>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#if BOOTLOADER_READBACK_VERIFY
+# define MODE_NAME  "read-back"
+#else
+# define MODE_NAME  "streaming"
+#endif
+
+namespace
+{
+
+constexpr std::size_t ImageSize = 200 * 1024;
+constexpr std::size_t DescriptorOffset = 0x400;
+constexpr std::size_t StorageSize = 240 * 1024;
+constexpr std::uint32_t VCSCommit = 0xC0FFEE;
+
+/**
+ * The seed zero selects the fixed chunk size of 256 bytes; otherwise the sizes are random even numbers.
+ */
+class Downloader : public os::bootloader::IDownloader
+{
+    const std::vector<std::uint8_t>& image_;
+    const unsigned seed_;
+
+public:
+    Downloader(const std::vector<std::uint8_t>& image, unsigned seed) :
+        image_(image),
+        seed_(seed)
+    { }
+
+    int download(os::bootloader::IDownloadStreamSink& sink) override
+    {
+        std::srand(seed_);
+        for (std::size_t offset = 0; offset < image_.size();)
+        {
+            const std::size_t chunk = (seed_ == 0) ? 256U : (2U + 2U * unsigned(std::rand() % 150));
+            const std::size_t size = std::min(image_.size() - offset, chunk);
+            const int res = sink.handleNextDataChunk(&image_[offset], size);
+            if (res < 0)
+            {
+                return res;
+            }
+            offset += size;
+        }
+        return 0;
+    }
+};
+
+/**
+ * If fake_signature_offset is non-zero, a signature that does not start a valid descriptor is placed there.
+ */
+std::vector<std::uint8_t> makeImage(bool corrupt_crc, std::size_t fake_signature_offset = 0)
+{
+    std::vector<std::uint8_t> image(ImageSize);
+    for (std::size_t i = 0; i < image.size(); i++)
+    {
+        image[i] = std::uint8_t(i * 131U + 7U);
+    }
+    static const char Signature[] = "APDesc00";
+    if (fake_signature_offset > 0)
+    {
+        std::memcpy(&image[fake_signature_offset], Signature, 8);
+    }
+    std::memcpy(&image[DescriptorOffset], Signature, 8);
+
+    os::bootloader::AppInfo info;
+    info.image_crc = 0;
+    info.image_size = std::uint32_t(ImageSize);
+    info.vcs_commit = VCSCommit;
+    info.major_version = 1;
+    info.minor_version = 2;
+    std::memcpy(&image[DescriptorOffset + 8], &info, sizeof(info));
+
+    os::bootloader::CRC64WE crc;
+    crc.add(image.data(), unsigned(image.size()));
+    info.image_crc = crc.get() ^ (corrupt_crc ? 1U : 0U);
+    std::memcpy(&image[DescriptorOffset + 8], &info.image_crc, sizeof(info.image_crc));
+    return image;
+}
+
+void run(const char* name, const std::vector<std::uint8_t>& image, const bool expect_valid, const unsigned seed)
+{
+    // The typical halfword program time and the maximum page erase time from the datasheet of STM32F105
+    os::host::NorFlashSimulator flash({ { 2048, 128 } }, 2, os::host::NorFlashTiming{ 52500, 40000000, false });
+    os::host::SimulatedAppStorageBackend storage(flash, 0, StorageSize);
+    os::bootloader::Bootloader bootloader(storage, StorageSize);
+    flash.resetStatistics();
+
+    Downloader downloader(image, seed);
+    const auto started_at = std::chrono::steady_clock::now();
+    const int res = bootloader.upgradeApp(downloader);
+    const std::chrono::duration<double, std::milli> wall = std::chrono::steady_clock::now() - started_at;
+
+    const auto info = bootloader.getAppInfo();
+    if ((res != 0) || (info.second != expect_valid) || (expect_valid && (info.first.vcs_commit != VCSCommit)))
+    {
+        std::printf("FAILED: %s, seed %u: result %d, app %s\n", name, seed, res, info.second ? "found" : "not found");
+        std::exit(1);
+    }
+
+    const auto& stats = flash.getStatistics();
+    std::printf("%-9s %-24s seed %u: app %-9s %7llu bytes read back, %.2f s simulated flash time, %.1f ms wall\n",
+                MODE_NAME, name, seed, info.second ? "found," : "not found,",
+                static_cast<unsigned long long>(stats.bytes_read), double(stats.elapsed_ns) / 1e9, wall.count());
+}
+
+}
+
+int main()
+{
+    for (unsigned seed : { 0U, 1U, 2U })
+    {
+        run("valid 200 KiB", makeImage(false), true, seed);
+        run("corrupted CRC", makeImage(true), false, seed);
+        run("fake signature before", makeImage(false, DescriptorOffset - 0x200), true, seed);
+    }
+    return 0;
+}
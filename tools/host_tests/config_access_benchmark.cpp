@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2026 Zubax, zubax.com
+ * Distributed under the MIT License, available in the file LICENSE.
+ * Author: Pavel Kirienko <pavel.kirienko@zubax.com>
+ */
+
+/*
+ * Cost of reading a param via its Param<> handle, which resolves the index once at registration, versus
+ * configGet(), which searches the params by name, like every access did before. CONFIG_PARAMS_MAX params are
+ * defined, so that the cost can be compared for different configuration sizes; eight of them are set to
+ * non-default values, which matters in the sparse mode (CONFIG_SPARSE_OVERRIDES_MAX). See run.sh.
+ */
+
+#include <zubax_chibios/platform/host/storage_backends.hpp>
+#include <benchmark.hpp>
+#include <cstdio>
+#include <deque>
+#include <string>
+#include <type_traits>
+
+#if defined(CONFIG_SPARSE_OVERRIDES_MAX) && (CONFIG_SPARSE_OVERRIDES_MAX > 0)
+# define MODE_NAME  "sparse"
+#else
+# define MODE_NAME  "dense"
+#endif
+
+namespace
+{
+
+using host_benchmark::measure;
+
+constexpr int NumOverrides = 8;
+constexpr unsigned Calls = 20000;
+
+volatile float g_sink;
+
+}
+
+int main()
+{
+    std::deque<std::string> names;
+    std::deque<std::remove_const_t<os::config::Param<int>>> params;
+    for (int i = 0; i < CONFIG_PARAMS_MAX; i++)
+    {
+        char name[32];
+        std::snprintf(name, sizeof(name), "bench.param_%04d", i);
+        names.emplace_back(name);
+        params.emplace_back(names.back().c_str(), i, -100000, 100000);
+    }
+
+    os::host::NorFlashSimulator flash({ { 4096, 16 } });
+    os::host::SimulatedConfigStorageBackend storage(flash, 0, flash.getSize());
+    if (os::config::init(&storage) < 0)
+    {
+        std::puts("init failed");
+        return 1;
+    }
+
+    // The first param is overridden, the last one is not
+    for (int i = 0; i < NumOverrides; i++)
+    {
+        if (params[std::size_t(i * (CONFIG_PARAMS_MAX / NumOverrides))].set(-1) < 0)
+        {
+            std::puts("set failed");
+            return 1;
+        }
+    }
+
+    const auto& first = params.front();
+    const auto& last = params.back();
+    const char* const first_name = names.front().c_str();
+    const char* const last_name = names.back().c_str();
+
+    const double handle_first = measure(Calls, [&first](unsigned i) { g_sink = float(first.get() + int(i)); });
+    const double handle_last  = measure(Calls, [&last](unsigned i)  { g_sink = float(last.get() + int(i)); });
+    const double name_first   = measure(Calls, [first_name](unsigned i) { g_sink = configGet(first_name) + float(i); });
+    const double name_last    = measure(Calls, [last_name](unsigned i)  { g_sink = configGet(last_name) + float(i); });
+
+    std::printf("%4d params, %-6s: Param<>::get() %6.1f ns first (overridden), %6.1f ns last (default); "
+                "configGet() %8.1f ns first, %8.1f ns last\n",
+                CONFIG_PARAMS_MAX, MODE_NAME, handle_first, handle_last, name_first, name_last);
+    return 0;
+}
@@ -0,0 +1,158 @@
+/*
+ * Copyright (c) 2026 Zubax, zubax.com
+ * Distributed under the MIT License, available in the file LICENSE.
+ * Author: Pavel Kirienko <pavel.kirienko@zubax.com>
+ */
+
+/*
+ * Lock-free readers against concurrent writers and a saver, on as many cores as the host has.
+ * Every writer keeps an invariant of the values it modifies, and the readers verify it on every read:
+ *  - a transaction sets the pair (a, b) to (k, -k), so a consistent read of the pair sums to zero;
+ *  - the 64-bit value always has equal halves, so a torn read is detected;
+ *  - all elements of the array are set at once to the same value.
+ * The saver writes the configuration into the NOR flash simulator meanwhile. See run.sh for the build variants.
+ */
+
+#include <zubax_chibios/platform/host/storage_backends.hpp>
+#include <atomic>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+os::config::Param<std::int32_t> g_a("stress.a", 0, -1000000000, 1000000000);
+os::config::Param<std::int32_t> g_b("stress.b", 0, -1000000000, 1000000000);
+os::config::Param<std::uint64_t> g_wide("stress.wide", 0, 0, UINT64_MAX);
+os::config::ParamArray<std::uint16_t, 8> g_table("stress.table", 0, 0, 65535);
+
+constexpr unsigned NumReaders = 3;
+constexpr int NumWrites = 100000;
+constexpr int NumSaves = 50;
+
+std::atomic<bool> g_stop{false};
+std::atomic<unsigned long> g_num_reads{0};
+std::atomic<unsigned long> g_num_errors{0};
+
+void fail(const char* what)
+{
+    if (g_num_errors++ < 10)
+    {
+        std::printf("FAILURE: %s\n", what);
+    }
+}
+
+void read()
+{
+    while (!g_stop)
+    {
+        const auto [a, b] = os::config::getConsistent(g_a, g_b);
+        if (a + b != 0)
+        {
+            fail("inconsistent pair");
+        }
+
+        const std::uint64_t wide = g_wide.get();
+        if ((wide >> 32U) != (wide & 0xFFFFFFFFU))
+        {
+            fail("torn 64-bit value");
+        }
+
+        const auto table = g_table.getAll();
+        for (std::size_t i = 1; i < table.size(); i++)
+        {
+            if (table[i] != table[0])
+            {
+                fail("inconsistent array");
+                break;
+            }
+        }
+
+        g_num_reads++;
+    }
+}
+
+void writePair()
+{
+    for (int k = 1; k <= NumWrites; k++)
+    {
+        os::config::Transaction<2> transaction;
+        transaction.set(g_a, k);
+        transaction.set(g_b, -k);
+        if (transaction.commit() < 0)
+        {
+            fail("transaction");
+        }
+    }
+}
+
+void writeOthers()
+{
+    for (int k = 1; k <= NumWrites; k++)
+    {
+        const std::uint64_t half = std::uint32_t(k) * 0x10001U;
+        if (g_wide.set((half << 32U) | half) < 0)
+        {
+            fail("set 64-bit value");
+        }
+
+        std::array<std::uint16_t, 8> table{};
+        table.fill(std::uint16_t(k));
+        if (g_table.setAll(table) < 0)
+        {
+            fail("set array");
+        }
+    }
+}
+
+void save()
+{
+    for (int i = 0; i < NumSaves; i++)
+    {
+        if (os::config::save() < 0)
+        {
+            fail("save");
+        }
+    }
+}
+
+}
+
+int main()
+{
+    os::host::NorFlashSimulator flash({ { 2048, 8 } });
+    os::host::SimulatedConfigStorageBackend storage(flash, 0, flash.getSize());
+    if (os::config::init(&storage) < 0)
+    {
+        std::puts("init failed");
+        return 1;
+    }
+
+    std::vector<std::thread> readers;
+    for (unsigned i = 0; i < NumReaders; i++)
+    {
+        readers.emplace_back(read);
+    }
+
+    std::thread pair_writer(writePair);
+    std::thread other_writer(writeOthers);
+    std::thread saver(save);
+
+    pair_writer.join();
+    other_writer.join();
+    saver.join();
+    g_stop = true;
+    for (auto& r : readers)
+    {
+        r.join();
+    }
+
+    if ((g_a.get() != NumWrites) || (g_b.get() != -NumWrites) || (g_table.get(7) != std::uint16_t(NumWrites)))
+    {
+        fail("final values");
+    }
+
+    std::printf("%lu reads, %lu errors\n", g_num_reads.load(), g_num_errors.load());
+    return (g_num_errors == 0) ? 0 : 1;
+}
@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2026 Zubax, zubax.com
+ * Distributed under the MIT License, available in the file LICENSE.
+ * Author: Pavel Kirienko <pavel.kirienko@zubax.com>
+ */
+
+/*
+ * Cost of the set path, which validates the value against the table built at init() and notifies the subscribers.
+ * Every call modifies the value, and nobody is subscribed.
+ */
+
+#include <zubax_chibios/platform/host/storage_backends.hpp>
+#include <benchmark.hpp>
+#include <cstdio>
+
+#if defined(CONFIG_SPARSE_OVERRIDES_MAX) && (CONFIG_SPARSE_OVERRIDES_MAX > 0)
+# define MODE_NAME  "sparse"
+#else
+# define MODE_NAME  "dense"
+#endif
+
+namespace
+{
+
+using host_benchmark::measure;
+
+os::config::Param<float> g_float("bench.float", 0.0F, -1000.0F, 1000.0F);
+os::config::Param<int> g_int("bench.int", 0, -1000, 1000);
+os::config::Param<bool> g_bool("bench.bool", false);
+
+constexpr unsigned Calls = 200000;
+
+}
+
+int main()
+{
+    os::host::NorFlashSimulator flash({ { 4096, 2 } });
+    os::host::SimulatedConfigStorageBackend storage(flash, 0, flash.getSize());
+    if (os::config::init(&storage) < 0)
+    {
+        std::puts("init failed");
+        return 1;
+    }
+
+    // The values alternate between 1 and 2, so that every call modifies the value
+    const double param_float = measure(Calls, [](unsigned i) { (void)g_float.set(float(1U + (i & 1U))); });
+    const double param_int   = measure(Calls, [](unsigned i) { (void)g_int.set(int(1U + (i & 1U))); });
+    const double param_bool  = measure(Calls, [](unsigned i) { (void)g_bool.set((i & 1U) != 0); });
+    const double name_float  = measure(Calls, [](unsigned i) { (void)configSet("bench.float", float(1U + (i & 1U))); });
+    const double name_int    = measure(Calls, [](unsigned i) { (void)configSet("bench.int", float(1U + (i & 1U))); });
+
+    if ((g_float.get() != 2.0F) || (g_int.get() != 2) || !g_bool.get())
+    {
+        std::puts("the values were not set");
+        return 1;
+    }
+
+    std::printf("%-6s: Param<>::set() %.1f ns float, %.1f ns int, %.1f ns bool; "
+                "configSet() %.1f ns float, %.1f ns int\n",
+                MODE_NAME, param_float, param_int, param_bool, name_float, name_int);
+    return 0;
+}
@@ -0,0 +1,152 @@
+/*
+ * Copyright (c) 2026 Zubax, zubax.com
+ * Distributed under the MIT License, available in the file LICENSE.
+ * Author: Pavel Kirienko <pavel.kirienko@zubax.com>
+ */
+
+/*
+ * The config module built with CONFIG_STATIC_REGISTRY: initialization, access via the Param<> objects and by name,
+ * a Param<> defined with the constructor under a name from the registry, and the save/restore cycle.
+ * The configuration can be restored only by a fresh instance of the module, so the test saves the flash image into
+ * a file and executes itself again with the path of the file to restore it.
+ */
+
+#include <zubax_chibios/config/static_registry.hpp>
+#include <zubax_chibios/platform/host/storage_backends.hpp>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+
+#define TEST_CONFIG_PARAMS(X)                                                                   \
+    X(float,         g_gain,     "ctl.gain",     1.0F,   0.0F,   10.0F)                         \
+    X(int,           g_period,   "ctl.period",   10,     1,      100)                           \
+    X(bool,          g_enabled,  "ctl.enabled",  true,   false,  true)                          \
+    X(std::uint16_t, g_mask,     "io.mask",      0x00FF, 0,      0xFFFF)                        \
+    X(std::int64_t,  g_offset,   "io.offset",    -5,     -1000000000000LL, 1000000000000LL)
+
+CONFIG_STATIC_REGISTRY_DECLARE(TEST_CONFIG_PARAMS)
+CONFIG_STATIC_REGISTRY_DEFINE()
+
+namespace
+{
+
+constexpr unsigned NumParams = 5;
+
+/// Same name as in the registry, but defined the compatible way; it refers to the same value as g_period.
+os::config::Param<int> g_period_alias("ctl.period", 10, 1, 100);
+
+unsigned g_num_errors = 0;
+
+void check(bool condition, const char* what)
+{
+    if (!condition)
+    {
+        g_num_errors++;
+        std::printf("FAILURE: %s\n", what);
+    }
+}
+
+template <typename T>
+const void* getMetadataAddress(const char* name)
+{
+    const auto metadata = os::config::getParamMetadata(name);
+    return (metadata && std::holds_alternative<os::config::Param<T>*>(*metadata)) ?
+        std::get<os::config::Param<T>*>(*metadata) : nullptr;
+}
+
+void testAccess()
+{
+    check(os::config::getParamCount() == NumParams, "param count");
+    check((g_gain.get() == 1.0F) && (g_period.get() == 10) && g_enabled.get() && (g_mask.get() == 0x00FF) &&
+          (g_offset.get() == -5), "defaults");
+
+    // Lookup by name; the registry is sorted by name, but the indexes follow the declaration order
+    for (int i = 0; i < int(NumParams); i++)
+    {
+        check(std::isfinite(configGet(configNameByIndex(i))), "lookup of the name by index");
+    }
+    check(std::strcmp(configNameByIndex(0), "ctl.gain") == 0, "declaration order");
+    check(!os::config::getParamMetadata("ctl.missing"), "unknown name");
+    check(getMetadataAddress<float>("ctl.gain") == &g_gain, "metadata of a registry param");
+
+    // Access by name and by the objects
+    check((configSet("ctl.gain", 2.5F) == 0) && (g_gain.get() == 2.5F), "set by name");
+    check((g_mask.set(0x1234) == 0) && (configGet("io.mask") == float(0x1234)), "set via the object");
+    check(g_period.set(101) < 0, "out of range value rejected");
+    check((g_offset.set(-4000000001LL) == 0) && (g_offset.get() == -4000000001LL), "64-bit value");
+    check((g_enabled.set(false) == 0) && (configGet("ctl.enabled") == 0.0F), "bool value");
+
+    // The compatibility alias is the same param
+    check(g_period_alias.index == g_period.index, "alias index");
+    check((g_period.set(42) == 0) && (g_period_alias.get() == 42), "set via the registry object");
+    check((g_period_alias.set(43) == 0) && (g_period.get() == 43) && (configGet("ctl.period") == 43.0F),
+          "set via the alias");
+}
+
+void testRestored()
+{
+    check((g_gain.get() == 2.5F) && (g_period.get() == 43) && !g_enabled.get() && (g_mask.get() == 0x1234) &&
+          (g_offset.get() == -4000000001LL) && (g_period_alias.get() == 43), "restored values");
+    check(os::config::getUnsavedParamCount() == 0, "nothing to save after the restore");
+}
+
+}
+
+int main(const int argc, char* const argv[])
+{
+    os::host::NorFlashSimulator flash({ { 2048, 2 } });
+    os::host::SimulatedConfigStorageBackend storage(flash, 0, flash.getSize());
+    const char* const image_path = (argc > 1) ? argv[1] : nullptr;
+
+    if (image_path != nullptr)
+    {
+        std::vector<std::uint8_t> image(flash.getSize());
+        FILE* const file = std::fopen(image_path, "rb");
+        const bool loaded = (file != nullptr) && (std::fread(image.data(), 1, image.size(), file) == image.size());
+        if (file != nullptr)
+        {
+            (void)std::fclose(file);
+        }
+        if (!loaded || (flash.program(0, image.data(), image.size()) != 0))
+        {
+            std::puts("could not load the image");
+            return 1;
+        }
+    }
+
+    const int init_res = os::config::init(&storage);
+    if (init_res < 0)
+    {
+        std::printf("init failed: %d\n", init_res);
+        return 1;
+    }
+
+    if (image_path == nullptr)
+    {
+        testAccess();
+        check(os::config::save() == 5, "save");
+
+        const std::string path = std::string(argv[0]) + ".img";
+        FILE* const file = std::fopen(path.c_str(), "wb");
+        const bool stored = (file != nullptr) && (std::fwrite(flash.getData(), 1, flash.getSize(), file) ==
+                                                  flash.getSize());
+        if ((file == nullptr) || (std::fclose(file) != 0) || !stored)
+        {
+            std::puts("could not store the image");
+            return 1;
+        }
+        std::printf("access: %u errors\n", g_num_errors);
+        if (g_num_errors == 0)
+        {
+            std::fflush(stdout);
+            (void)execl(argv[0], argv[0], path.c_str(), static_cast<char*>(nullptr));
+            std::puts("could not restart");
+        }
+        return 1;
+    }
+
+    testRestored();
+    std::printf("restore: %u errors\n", g_num_errors);
+    return (g_num_errors == 0) ? 0 : 1;
+}
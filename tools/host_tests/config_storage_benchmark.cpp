@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2026 Zubax, zubax.com
+ * Distributed under the MIT License, available in the file LICENSE.
+ * Author: Pavel Kirienko <pavel.kirienko@zubax.com>
+ */
+
+/*
+ * Cost of a save in the storage format selected by CONFIG_STORAGE_JOURNAL, when one param is changed per save.
+ * The storage is 16 KiB of the NOR flash simulator with the geometry and the timing of STM32F105: 2 KiB pages,
+ * halfword programming in 52.5 us, and the page erase in 40 ms (worst case). See run.sh for the build variants.
+ */
+
+#include <zubax_chibios/platform/host/storage_backends.hpp>
+#include <cstdio>
+#include <deque>
+#include <string>
+#include <type_traits>
+
+namespace
+{
+
+constexpr unsigned NumParams = 40;
+constexpr unsigned NumSaves = 1000;
+
+}
+
+int main()
+{
+    std::deque<std::string> names;
+    std::deque<std::remove_const_t<os::config::Param<float>>> params;
+    for (unsigned i = 0; i < NumParams; i++)
+    {
+        names.emplace_back("bench.param_" + std::to_string(i));
+        params.emplace_back(names.back().c_str(), 0.0F, -1e6F, 1e6F);
+    }
+
+    const os::host::NorFlashTiming timing{ 52500, 40000000, false };
+    os::host::NorFlashSimulator flash({ { 2048, 128 } }, 2, timing);
+    os::host::SimulatedConfigStorageBackend storage(flash, 2048 * 120, 2048 * 8);
+    if (os::config::init(&storage) < 0)
+    {
+        std::puts("init failed");
+        return 1;
+    }
+
+    flash.resetStatistics();
+    for (unsigned i = 0; i < NumSaves; i++)
+    {
+        if ((params[i % NumParams].set(float(i)) < 0) || (os::config::save() < 0))
+        {
+            std::puts("save failed");
+            return 1;
+        }
+    }
+
+    const auto& stats = flash.getStatistics();
+    std::printf("%s: %u saves of %u params, one changed per save: %.3f pages erased per save, "
+                "%.0f bytes programmed per save, %.2f ms per save, max page erase count %u\n",
+                CONFIG_STORAGE_JOURNAL ? "journal" : "image", NumSaves, NumParams,
+                double(stats.erase_units) / NumSaves, double(stats.bytes_programmed) / NumSaves,
+                double(stats.elapsed_ns) / NumSaves / 1e6, unsigned(flash.getMaxEraseCount()));
+    return 0;
+}
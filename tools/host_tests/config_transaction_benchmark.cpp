@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2026 Zubax, zubax.com
+ * Distributed under the MIT License, available in the file LICENSE.
+ * Author: Pavel Kirienko <pavel.kirienko@zubax.com>
+ */
+
+/*
+ * Cost of setting 50 params at once: a loop of configSet() versus one Transaction<> that stages the values by name
+ * or by the Param<> handle. The mutex of the host is much cheaper than that of the RTOS, so the difference on the
+ * target is larger, because the loop takes the mutex and enters a critical section per param.
+ */
+
+#include <zubax_chibios/platform/host/storage_backends.hpp>
+#include <benchmark.hpp>
+#include <cstdio>
+#include <deque>
+#include <string>
+#include <type_traits>
+
+namespace
+{
+
+using host_benchmark::measure;
+
+constexpr unsigned NumParams = 50;
+constexpr unsigned Calls = 2000;
+
+float valueOf(unsigned call, unsigned param)
+{
+    return float((call + param) % 100U);
+}
+
+}
+
+int main()
+{
+    std::deque<std::string> names;
+    std::deque<std::remove_const_t<os::config::Param<float>>> params;
+    for (unsigned i = 0; i < NumParams; i++)
+    {
+        char name[32];
+        std::snprintf(name, sizeof(name), "tune.param_%02u", i);
+        names.emplace_back(name);
+        params.emplace_back(names.back().c_str(), 0.0F, -1000.0F, 1000.0F);
+    }
+
+    os::host::NorFlashSimulator flash({ { 4096, 2 } });
+    os::host::SimulatedConfigStorageBackend storage(flash, 0, flash.getSize());
+    if (os::config::init(&storage) < 0)
+    {
+        std::puts("init failed");
+        return 1;
+    }
+
+    const double loop = measure<std::micro>(Calls, [&names](unsigned call)
+        {
+            for (unsigned i = 0; i < NumParams; i++)
+            {
+                (void)configSet(names[i].c_str(), valueOf(call, i));
+            }
+        });
+
+    const double by_name = measure<std::micro>(Calls, [&names](unsigned call)
+        {
+            os::config::Transaction<NumParams> transaction;
+            for (unsigned i = 0; i < NumParams; i++)
+            {
+                (void)transaction.set(names[i].c_str(), valueOf(call, i));
+            }
+            (void)transaction.commit();
+        });
+
+    const double by_handle = measure<std::micro>(Calls, [&params](unsigned call)
+        {
+            os::config::Transaction<NumParams> transaction;
+            for (unsigned i = 0; i < NumParams; i++)
+            {
+                (void)transaction.set(params[i], valueOf(call, i));
+            }
+            (void)transaction.commit();
+        });
+
+    // Make sure the transactions were actually applied
+    if (params[NumParams - 1].get() != valueOf(Calls - 1, NumParams - 1))
+    {
+        std::puts("the values were not set");
+        return 1;
+    }
+
+    std::printf("%u params: configSet() loop %.2f us, Transaction<> by name %.2f us, by handle %.2f us\n",
+                NumParams, loop, by_name, by_handle);
+    return 0;
+}
@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2026 Zubax, zubax.com
+ * Distributed under the MIT License, available in the file LICENSE.
+ * Author: Pavel Kirienko <pavel.kirienko@zubax.com>
+ */
+
+/*
+ * Throughput of CRC64WE for the configured BOOTLOADER_CRC64WE_SLICES, see run.sh. Before measuring, the result is
+ * checked against the check value of the algorithm and against a bit-serial reference implementation for all
+ * alignments, lengths, and splits of the input that matter to the sliced implementations.
+ */
+
+#include <zubax_chibios/bootloader/util.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+namespace
+{
+
+constexpr std::uint64_t CheckValue = 0x62EC59E3F1A4F00AULL;     // CRC of "123456789"
+constexpr std::size_t ImageSize = 256 * 1024;
+
+std::uint64_t computeReference(const std::uint8_t* data, std::size_t size)
+{
+    std::uint64_t crc = ~0ULL;
+    while (size --> 0)
+    {
+        crc ^= std::uint64_t(*data++) << 56U;
+        for (int i = 0; i < 8; i++)
+        {
+            crc = ((crc >> 63U) != 0) ? ((crc << 1U) ^ 0x42F0E1EBA9EA3693ULL) : (crc << 1U);
+        }
+    }
+    return ~crc;
+}
+
+}
+
+int main()
+{
+    os::bootloader::CRC64WE check;
+    check.add("123456789", 9);
+    if (check.get() != CheckValue)
+    {
+        std::printf("FAILED: check value %016llx\n", static_cast<unsigned long long>(check.get()));
+        return 1;
+    }
+
+    std::vector<std::uint8_t> buffer(ImageSize + 64);
+    for (auto& x : buffer)
+    {
+        x = std::uint8_t(std::rand());
+    }
+
+    for (unsigned offset = 0; offset < 9; offset++)
+    {
+        for (unsigned length = 0; length < 100; length++)
+        {
+            for (unsigned split = 0; split <= length; split += 7)
+            {
+                os::bootloader::CRC64WE crc;
+                crc.add(&buffer[offset], split);
+                crc.add(&buffer[offset + split], length - split);
+                if (crc.get() != computeReference(&buffer[offset], length))
+                {
+                    std::printf("FAILED: offset %u length %u split %u\n", offset, length, split);
+                    return 1;
+                }
+            }
+        }
+    }
+
+    // The data is misaligned on purpose, as it may be in a transfer buffer
+    double best = 1e9;
+    std::uint64_t sink = 0;
+    for (int rep = 0; rep < 300; rep++)
+    {
+        const auto started_at = std::chrono::steady_clock::now();
+        os::bootloader::CRC64WE crc;
+        crc.add(&buffer[1], ImageSize);
+        sink ^= crc.get();
+        best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - started_at).count());
+    }
+
+    std::printf("slices %d: 256 KiB in %.3f ms, %.0f MB/s (%u)\n", BOOTLOADER_CRC64WE_SLICES, best * 1e3,
+                double(ImageSize) / best / 1e6, unsigned(sink & 1U));
+    return 0;
+}
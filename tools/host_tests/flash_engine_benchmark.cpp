@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) 2026 Zubax, zubax.com
+ * Distributed under the MIT License, available in the file LICENSE.
+ * Author: Pavel Kirienko <pavel.kirienko@zubax.com>
+ */
+
+/*
+ * The flash engine on the model of the STM32F105 flash controller, see include/fpec_model.hpp:
+ *  - the cost of erasing via the engine versus synchronously, for the submitting thread;
+ *  - a caller of a higher priority than the engine executes the queued requests in the order of submission;
+ *  - starting the engine while a request is being executed synchronously does not interleave the FPEC accesses.
+ * The host does not model the priorities, so the priority inversion itself can not be reproduced here.
+ */
+
+#include <zubax_chibios/platform/stm32/flash_engine.hpp>
+#include <hal.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <thread>
+
+namespace
+{
+
+constexpr unsigned NumErasedPages = 4;
+constexpr std::size_t ErasedSize = NumErasedPages * host_fpec::PageSize;
+
+[[noreturn]] void finish(int code)
+{
+    // The engine thread is still alive and can not be joined
+    std::fflush(stdout);
+    std::_Exit(code);
+}
+
+void check(bool condition, const char* what)
+{
+    if (!condition)
+    {
+        std::printf("FAILED: %s\n", what);
+        finish(1);
+    }
+}
+
+/**
+ * Programs the pages so that they are not blank, otherwise FlashWriter would skip the erasure.
+ */
+void dirty(std::uint8_t* where, std::size_t size)
+{
+    static const std::uint16_t zero = 0;
+    for (std::size_t offset = 0; offset < size; offset += host_fpec::PageSize)
+    {
+        check(os::stm32::programFlash(where + offset, &zero, sizeof(zero)) == 0, "dirty");
+    }
+}
+
+struct Measurement
+{
+    double wall_ms = 0;
+    double cpu_ms = 0;
+};
+
+template <typename Function>
+Measurement measure(Function function)
+{
+    const std::clock_t cpu_started_at = std::clock();
+    const auto started_at = std::chrono::steady_clock::now();
+    function();
+    Measurement m;
+    m.wall_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started_at).count();
+    m.cpu_ms = double(std::clock() - cpu_started_at) * 1000.0 / CLOCKS_PER_SEC;
+    return m;
+}
+
+}
+
+int main()
+{
+    std::uint8_t* const flash = host_fpec::getMemory();
+
+    // Synchronous erasure before the engine is started; a request of another thread arriving in the middle of it
+    // starts the engine, which must wait for the synchronous request to complete
+    dirty(flash, ErasedSize);
+    const Measurement sync_erase = measure([flash]()
+        {
+            std::thread starter([flash]()
+                {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(HOST_FPEC_PAGE_ERASE_MSEC / 2));
+                    check(os::stm32::startFlashEngine(LOWPRIO) == 0, "start");
+                    static const std::uint16_t value = 0x1234;
+                    os::stm32::FlashRequest request;
+                    request.setProgram(flash + ErasedSize, &value, sizeof(value));
+                    os::stm32::submitFlashRequest(request);
+                    check(request.wait() == 0, "concurrent");
+                });
+            check(os::stm32::eraseFlash(flash, ErasedSize) == 0, "sync erase");
+            starter.join();
+        });
+    check(host_fpec::getNumConflicts() == 0, "the FPEC accesses of the engine interleaved with a sync request");
+
+    // Erasure via the engine; the submitter is free meanwhile
+    dirty(flash, ErasedSize);
+    os::stm32::FlashRequest erase;
+    erase.setErase(flash, ErasedSize);
+    const Measurement engine_erase = measure([&erase]()
+        {
+            os::stm32::submitFlashRequest(erase);
+            check(erase.wait() == 0, "engine erase");
+        });
+
+    dirty(flash, ErasedSize);
+    unsigned long iterations = 0;
+    os::stm32::submitFlashRequest(erase);
+    while (erase.isPending())
+    {
+        iterations++;
+        std::this_thread::yield();
+    }
+    check(erase.wait() == 0, "engine erase");
+
+    // The queued requests overwrite the same location, so the final value reveals the order of execution
+    dirty(flash, ErasedSize);
+    static const std::uint16_t values[] = { 1, 2, 3, 4 };
+    os::stm32::FlashRequest background_erase;
+    os::stm32::FlashRequest queued[3];
+    background_erase.setErase(flash, ErasedSize);
+    os::stm32::submitFlashRequest(background_erase);
+    for (unsigned i = 0; i < 3; i++)
+    {
+        queued[i].setProgram(flash + ErasedSize, &values[i], sizeof(values[i]));
+        os::stm32::submitFlashRequest(queued[i]);
+    }
+    const tprio_t old_priority = chibios_rt::BaseThread::setPriority(HIGHPRIO);
+    const Measurement high_priority = measure([flash]()
+        {
+            check(os::stm32::programFlash(flash + ErasedSize, &values[3], sizeof(values[3])) == 0, "high priority");
+        });
+    (void)chibios_rt::BaseThread::setPriority(old_priority);
+    check(!background_erase.isPending(), "the background erase is not completed");
+    for (auto& q : queued)
+    {
+        check(!q.isPending() && (q.wait() == 0), "a queued request is not completed");
+    }
+    std::uint16_t final_value = 0;
+    std::memcpy(&final_value, flash + ErasedSize, sizeof(final_value));
+    check(final_value == values[3], "the requests were executed out of order");
+    check(host_fpec::getNumConflicts() == 0, "the FPEC accesses interleaved");
+
+    std::printf("Erase of %u pages: sync %.0f ms wall, %.1f ms CPU; engine %.0f ms wall, %.1f ms CPU, "
+                "%lu submitter iterations meanwhile\n",
+                NumErasedPages, sync_erase.wall_ms, sync_erase.cpu_ms, engine_erase.wall_ms, engine_erase.cpu_ms,
+                iterations);
+    std::printf("High priority program behind an erase and 3 queued programs: %.0f ms wall\n", high_priority.wall_ms);
+    finish(0);
+}
@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) 2026 Zubax, zubax.com
+ * Distributed under the MIT License, available in the file LICENSE.
+ * Author: Pavel Kirienko <pavel.kirienko@zubax.com>
+ */
+
+/*
+ * Timing helpers shared by the host benchmarks.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <ratio>
+
+namespace host_benchmark
+{
+/**
+ * Invokes the function the specified number of times, passing the call number, and repeats that several times.
+ * Returns the best time per call in the units of Period, nanoseconds by default.
+ * The best of the repetitions is the least affected by the other activity on the host.
+ */
+template <typename Period = std::nano, typename Function>
+double measure(const unsigned calls, Function function)
+{
+    constexpr unsigned Repetitions = 7;
+    double best = 1e9;
+    for (unsigned rep = 0; rep < Repetitions; rep++)
+    {
+        const auto started_at = std::chrono::steady_clock::now();
+        for (unsigned i = 0; i < calls; i++)
+        {
+            function(i);
+        }
+        const std::chrono::duration<double, Period> elapsed = std::chrono::steady_clock::now() - started_at;
+        best = std::min(best, elapsed.count() / calls);
+    }
+    return best;
+}
+
+}
@@ -0,0 +1,376 @@
+/*
+ * Copyright (c) 2026 Zubax, zubax.com
+ * Distributed under the MIT License, available in the file LICENSE.
+ * Author: Pavel Kirienko <pavel.kirienko@zubax.com>
+ */
+
+/*
+ * Host stand-in for the subset of the ChibiOS API that is used by the libraries under test.
+ * Threads are std::thread, and the kernel lock is a global recursive mutex; interrupts are emulated by invoking
+ * the handlers from ordinary threads. The system tick is one millisecond. This is enough to exercise the logic and
+ * the concurrency of the libraries on a multi-core host, but the scheduling properties of the RTOS, e.g. the
+ * priorities, are not modeled: a thread is never preempted in favor of another one.
+ */
+
+#pragma once
+
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+typedef std::uint32_t syssts_t;
+typedef std::uint32_t systime_t;
+typedef std::uint32_t sysinterval_t;
+typedef int tprio_t;
+typedef std::uint32_t eventflags_t;
+typedef std::uint32_t eventmask_t;
+typedef int msg_t;
+
+#define MSG_OK                  0
+#define MSG_TIMEOUT             -1
+
+#define TIME_IMMEDIATE          ((sysinterval_t)0)
+#define TIME_INFINITE           ((sysinterval_t)-1)
+
+#define CH_CFG_ST_FREQUENCY     1000
+#define CH_CFG_USE_REGISTRY     1
+
+#define TIME_MS2I(x)            ((sysinterval_t)(x))
+#define TIME_US2I(x)            ((sysinterval_t)(((x) + 999) / 1000))
+#define TIME_S2I(x)             ((sysinterval_t)((x) * 1000))
+#define TIME_I2MS(x)            (x)
+#define TIME_I2US(x)            ((x) * 1000)
+
+#define LOWPRIO                 1
+#define NORMALPRIO              128
+#define HIGHPRIO                255
+
+#define EVENT_MASK(eid)         ((eventmask_t)1 << (eventmask_t)(eid))
+#define ALL_EVENTS              ((eventmask_t)-1)
+
+namespace host_chibios
+{
+
+inline std::recursive_mutex& getKernelLock()
+{
+    static std::recursive_mutex mutex;
+    return mutex;
+}
+
+inline tprio_t& getCurrentPriority()
+{
+    thread_local tprio_t priority = NORMALPRIO;
+    return priority;
+}
+
+}
+
+struct thread_t
+{
+    const char* name;
+};
+
+/*
+ * Kernel lock
+ */
+inline syssts_t chSysGetStatusAndLockX() { host_chibios::getKernelLock().lock(); return 0; }
+inline void chSysRestoreStatusX(syssts_t) { host_chibios::getKernelLock().unlock(); }
+inline void chSysLock() { host_chibios::getKernelLock().lock(); }
+inline void chSysUnlock() { host_chibios::getKernelLock().unlock(); }
+inline void chSysLockFromISR() { host_chibios::getKernelLock().lock(); }
+inline void chSysUnlockFromISR() { host_chibios::getKernelLock().unlock(); }
+inline void chSchRescheduleS() { }
+
+[[noreturn]] inline void chSysHalt(const char* msg)
+{
+    std::fprintf(stderr, "HALT: %s\n", msg);
+    std::abort();
+}
+
+/*
+ * Time
+ */
+inline systime_t chVTGetSystemTimeX()
+{
+    using namespace std::chrono;
+    return systime_t(duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count());
+}
+
+inline systime_t chVTGetSystemTime() { return chVTGetSystemTimeX(); }
+
+inline sysinterval_t chVTTimeElapsedSinceX(systime_t start) { return chVTGetSystemTimeX() - start; }
+
+/*
+ * Threads
+ */
+inline void chThdSleep(sysinterval_t interval)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(interval));
+}
+
+inline void chThdSleepMilliseconds(unsigned msec) { chThdSleep(TIME_MS2I(msec)); }
+
+inline void chThdSleepUntil(systime_t time)
+{
+    const systime_t now = chVTGetSystemTimeX();
+    if (std::int32_t(time - now) > 0)
+    {
+        chThdSleep(time - now);
+    }
+}
+
+inline thread_t* chThdGetSelfX()
+{
+    thread_local thread_t self{ "host" };
+    return &self;
+}
+
+inline tprio_t chThdGetPriorityX() { return host_chibios::getCurrentPriority(); }
+
+/*
+ * Binary semaphores
+ */
+struct binary_semaphore_t
+{
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool taken;
+};
+
+#define BSEMAPHORE_DECL(name, taken)    binary_semaphore_t name{ {}, {}, taken }
+
+inline void chBSemObjectInit(binary_semaphore_t* bsp, bool taken) { bsp->taken = taken; }
+
+inline msg_t chBSemWaitTimeout(binary_semaphore_t* bsp, sysinterval_t timeout)
+{
+    std::unique_lock<std::mutex> lock(bsp->mutex);
+    if (timeout == TIME_INFINITE)
+    {
+        bsp->cv.wait(lock, [bsp]() { return !bsp->taken; });
+    }
+    else if (!bsp->cv.wait_for(lock, std::chrono::milliseconds(timeout), [bsp]() { return !bsp->taken; }))
+    {
+        return MSG_TIMEOUT;
+    }
+    bsp->taken = true;
+    return MSG_OK;
+}
+
+inline msg_t chBSemWait(binary_semaphore_t* bsp) { return chBSemWaitTimeout(bsp, TIME_INFINITE); }
+
+inline void chBSemSignalI(binary_semaphore_t* bsp)
+{
+    {
+        std::lock_guard<std::mutex> lock(bsp->mutex);
+        bsp->taken = false;
+    }
+    bsp->cv.notify_all();
+}
+
+inline void chBSemSignal(binary_semaphore_t* bsp) { chBSemSignalI(bsp); }
+
+inline void chBSemResetI(binary_semaphore_t* bsp, bool taken)
+{
+    std::lock_guard<std::mutex> lock(bsp->mutex);
+    bsp->taken = taken;
+}
+
+inline void chBSemReset(binary_semaphore_t* bsp, bool taken) { chBSemResetI(bsp, taken); }
+
+/*
+ * Events. Every thread has its own set of pending events; the listener lists are protected by the kernel lock.
+ */
+namespace host_chibios
+{
+
+struct ThreadEvents
+{
+    std::mutex mutex;
+    std::condition_variable cv;
+    eventmask_t pending = 0;
+};
+
+inline ThreadEvents& getThreadEvents()
+{
+    thread_local ThreadEvents events;
+    return events;
+}
+
+}
+
+struct event_listener_t
+{
+    event_listener_t* next;
+    host_chibios::ThreadEvents* thread;
+    eventmask_t events;
+    eventflags_t flags;
+    eventflags_t wflags;
+};
+
+struct event_source_t
+{
+    event_listener_t* next = nullptr;
+};
+
+#define EVENTSOURCE_DECL(name)          event_source_t name
+
+inline void chEvtObjectInit(event_source_t* esp) { esp->next = nullptr; }
+
+inline void chEvtRegisterMaskWithFlags(event_source_t* esp, event_listener_t* elp, eventmask_t events,
+                                       eventflags_t wflags)
+{
+    std::lock_guard<std::recursive_mutex> lock(host_chibios::getKernelLock());
+    *elp = event_listener_t{ esp->next, &host_chibios::getThreadEvents(), events, 0, wflags };
+    esp->next = elp;
+}
+
+inline void chEvtRegisterMask(event_source_t* esp, event_listener_t* elp, eventmask_t events)
+{
+    chEvtRegisterMaskWithFlags(esp, elp, events, ALL_EVENTS);
+}
+
+inline void chEvtUnregister(event_source_t* esp, event_listener_t* elp)
+{
+    std::lock_guard<std::recursive_mutex> lock(host_chibios::getKernelLock());
+    for (event_listener_t** p = &esp->next; *p != nullptr; p = &(*p)->next)
+    {
+        if (*p == elp)
+        {
+            *p = elp->next;
+            break;
+        }
+    }
+}
+
+inline void chEvtBroadcastFlagsI(event_source_t* esp, eventflags_t flags)
+{
+    std::lock_guard<std::recursive_mutex> lock(host_chibios::getKernelLock());
+    for (event_listener_t* elp = esp->next; elp != nullptr; elp = elp->next)
+    {
+        elp->flags |= flags;
+        if ((flags == 0) || ((elp->flags & elp->wflags) != 0))
+        {
+            {
+                std::lock_guard<std::mutex> thread_lock(elp->thread->mutex);
+                elp->thread->pending |= elp->events;
+            }
+            elp->thread->cv.notify_all();
+        }
+    }
+}
+
+inline void chEvtBroadcastFlags(event_source_t* esp, eventflags_t flags) { chEvtBroadcastFlagsI(esp, flags); }
+
+inline eventflags_t chEvtGetAndClearFlags(event_listener_t* elp)
+{
+    std::lock_guard<std::recursive_mutex> lock(host_chibios::getKernelLock());
+    const eventflags_t flags = elp->flags;
+    elp->flags = 0;
+    return flags;
+}
+
+/**
+ * Returns and clears the pending events of the calling thread that match the mask, or zero on timeout.
+ */
+inline eventmask_t chEvtWaitAnyTimeout(eventmask_t events, sysinterval_t timeout)
+{
+    host_chibios::ThreadEvents& self = host_chibios::getThreadEvents();
+    std::unique_lock<std::mutex> lock(self.mutex);
+    const auto ready = [&self, events]() { return (self.pending & events) != 0; };
+    if (timeout == TIME_INFINITE)
+    {
+        self.cv.wait(lock, ready);
+    }
+    else if (!self.cv.wait_for(lock, std::chrono::milliseconds(timeout), ready))
+    {
+        return 0;
+    }
+    const eventmask_t out = self.pending & events;
+    self.pending &= ~out;
+    return out;
+}
+
+inline eventmask_t chEvtWaitAny(eventmask_t events) { return chEvtWaitAnyTimeout(events, TIME_INFINITE); }
+
+inline eventmask_t chEvtGetAndClearEvents(eventmask_t events)
+{
+    host_chibios::ThreadEvents& self = host_chibios::getThreadEvents();
+    std::lock_guard<std::mutex> lock(self.mutex);
+    const eventmask_t out = self.pending & events;
+    self.pending &= ~out;
+    return out;
+}
+
+namespace chibios_rt
+{
+
+class Mutex
+{
+    std::mutex mutex_;
+
+public:
+    void lock() { mutex_.lock(); }
+    void unlock() { mutex_.unlock(); }
+    bool tryLock() { return mutex_.try_lock(); }
+};
+
+struct ThreadReference
+{
+    thread_t* thread_ref = nullptr;
+};
+
+struct BaseThread
+{
+    static tprio_t setPriority(tprio_t new_priority)
+    {
+        const tprio_t old = host_chibios::getCurrentPriority();
+        host_chibios::getCurrentPriority() = new_priority;
+        return old;
+    }
+};
+
+struct System
+{
+    [[noreturn]] static void halt(const char* msg) { chSysHalt(msg); }
+    static void lock() { chSysLock(); }
+    static void unlock() { chSysUnlock(); }
+};
+
+/**
+ * The thread is detached when the object is destroyed, which happens at exit.
+ */
+template <int StackSize>
+class BaseStaticThread : public BaseThread
+{
+    std::thread thread_;
+
+public:
+    virtual ~BaseStaticThread()
+    {
+        if (thread_.joinable())
+        {
+            thread_.detach();
+        }
+    }
+
+    virtual void main() = 0;
+
+    void setName(const char* name) { chThdGetSelfX()->name = name; }
+
+    ThreadReference start(tprio_t priority)
+    {
+        thread_ = std::thread([this, priority]()
+            {
+                host_chibios::getCurrentPriority() = priority;
+                main();
+            });
+        return ThreadReference();
+    }
+};
+
+}
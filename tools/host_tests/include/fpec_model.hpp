@@ -0,0 +1,171 @@
+/*
+ * Copyright (c) 2026 Zubax, zubax.com
+ * Distributed under the MIT License, available in the file LICENSE.
+ * Author: Pavel Kirienko <pavel.kirienko@zubax.com>
+ */
+
+/*
+ * Model of the flash program/erase controller (FPEC) of STM32F105, enabled by defining HOST_FPEC_MODEL; it allows
+ * to run FlashWriter and the flash engine on the host. The flash memory is mapped at FLASH_BASE.
+ * Programming is a plain memory write, like on the hardware while FLASH_CR_PG is set. A page erase takes
+ * HOST_FPEC_PAGE_ERASE_MSEC in a separate thread, which then raises the FLASH interrupt if it is enabled, by invoking
+ * the handler of the vector 0x50 (see flash_engine_stm32.cpp) if it is linked.
+ *
+ * The model also detects the accesses to the FPEC that interleave with an operation started by another thread,
+ * which would corrupt the operation on the hardware; see host_fpec::getNumConflicts().
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <sys/mman.h>
+
+#define STM32F105xC
+#define FLASH_BASE                  0x08000000UL
+#define FLASH_SIZE                  (256U * 1024U)
+
+#define FLASH_SR_BSY                0x00000001U
+#define FLASH_SR_EOP                0x00000020U
+#define FLASH_SR_WRPERR             0x00000010U
+#define FLASH_SR_PGERR              0x00000004U
+
+#define FLASH_CR_PG                 0x00000001U
+#define FLASH_CR_PER                0x00000002U
+#define FLASH_CR_STRT               0x00000040U
+#define FLASH_CR_LOCK               0x00000080U
+#define FLASH_CR_ERRIE              0x00000400U
+#define FLASH_CR_EOPIE              0x00001000U
+
+#define FLASH_IRQn                  4
+#define CORTEX_MINIMUM_PRIORITY     15
+
+#define CH_IRQ_HANDLER(id)          void id(void)
+#define CH_IRQ_PROLOGUE()
+#define CH_IRQ_EPILOGUE()
+
+#ifndef HOST_FPEC_PAGE_ERASE_MSEC
+# define HOST_FPEC_PAGE_ERASE_MSEC  20
+#endif
+
+inline void nvicEnableVector(int, int) { }
+
+extern "C" void Vector50(void) __attribute__((weak));
+
+namespace host_fpec
+{
+
+constexpr std::size_t PageSize = 2048;
+
+inline std::atomic<unsigned>& getNumConflictsRef()
+{
+    static std::atomic<unsigned> counter{0};
+    return counter;
+}
+
+/**
+ * Number of the FPEC accesses that interleaved with an operation started by another thread.
+ */
+inline unsigned getNumConflicts() { return getNumConflictsRef().load(); }
+
+inline std::uint8_t* getMemory()
+{
+    static std::uint8_t* const memory = []()
+        {
+            void* const p = ::mmap(reinterpret_cast<void*>(FLASH_BASE), FLASH_SIZE, PROT_READ | PROT_WRITE,
+                                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+            if (p != reinterpret_cast<void*>(FLASH_BASE))
+            {
+                std::fputs("Could not map the flash memory\n", stderr);
+                std::abort();
+            }
+            std::memset(p, 0xFF, FLASH_SIZE);
+            return static_cast<std::uint8_t*>(p);
+        }();
+    return memory;
+}
+
+/**
+ * Writing ones clears the flags, like on the hardware.
+ */
+struct StatusRegister
+{
+    std::atomic<std::uint32_t> value{FLASH_SR_EOP};
+
+    operator std::uint32_t() const { return value.load(); }
+
+    StatusRegister& operator|=(std::uint32_t x)
+    {
+        value &= ~(x & (FLASH_SR_EOP | FLASH_SR_WRPERR | FLASH_SR_PGERR));
+        return *this;
+    }
+};
+
+struct ControlRegister
+{
+    std::atomic<std::uint32_t> value{FLASH_CR_LOCK};
+    std::atomic<std::thread::id> owner{};     ///< The thread that started the current operation, if any
+
+    operator std::uint32_t() const { return value.load(); }
+
+    void write(std::uint32_t x);
+
+    ControlRegister& operator=(std::uint32_t x) { write(x); return *this; }
+    ControlRegister& operator|=(std::uint32_t x) { write(value.load() | x); return *this; }
+    ControlRegister& operator&=(std::uint32_t x) { value &= x; return *this; }   // Used by the ISR only
+};
+
+struct Registers
+{
+    StatusRegister SR;
+    ControlRegister CR;
+    std::uint32_t KEYR = 0;
+    std::uint32_t AR = 0;
+};
+
+inline Registers& getRegisters()
+{
+    static Registers registers;
+    return registers;
+}
+
+inline void ControlRegister::write(std::uint32_t x)
+{
+    const std::thread::id self = std::this_thread::get_id();
+    const std::uint32_t operation_bits = FLASH_CR_PG | FLASH_CR_PER;
+    if (((value.load() & operation_bits) != 0) && (owner.load() != self))
+    {
+        getNumConflictsRef()++;
+    }
+    owner = ((x & operation_bits) != 0) ? self : std::thread::id();
+
+    Registers& regs = getRegisters();
+    if (((x & (FLASH_CR_PER | FLASH_CR_STRT)) == (FLASH_CR_PER | FLASH_CR_STRT)) && !(regs.SR & FLASH_SR_BSY))
+    {
+        regs.SR.value |= FLASH_SR_BSY;
+        value = x & ~FLASH_CR_STRT;
+        const std::size_t page = std::size_t(regs.AR) & ~(PageSize - 1U);
+        std::thread([page]()
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(HOST_FPEC_PAGE_ERASE_MSEC));
+                Registers& r = getRegisters();
+                std::memset(reinterpret_cast<void*>(page), 0xFF, PageSize);
+                r.SR.value = (r.SR.value.load() & ~FLASH_SR_BSY) | FLASH_SR_EOP;
+                if (((r.CR & FLASH_CR_EOPIE) != 0) && (Vector50 != nullptr))
+                {
+                    Vector50();
+                }
+            }).detach();
+        return;
+    }
+    value = x;
+}
+
+}
+
+#define FLASH                       (&::host_fpec::getRegisters())
@@ -0,0 +1,18 @@
+/*
+ * Copyright (c) 2026 Zubax, zubax.com
+ * Distributed under the MIT License, available in the file LICENSE.
+ * Author: Pavel Kirienko <pavel.kirienko@zubax.com>
+ */
+
+/*
+ * Host stand-in for the ChibiOS HAL. The only peripheral that is modeled is the flash controller of STM32F105,
+ * if HOST_FPEC_MODEL is defined; see fpec_model.hpp.
+ */
+
+#pragma once
+
+#include <ch.hpp>
+
+#ifdef HOST_FPEC_MODEL
+# include "fpec_model.hpp"
+#endif
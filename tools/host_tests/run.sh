@@ -0,0 +1,87 @@
+#!/bin/bash
+#
+# Copyright (c) 2026 Zubax, zubax.com
+# Distributed under the MIT License, available in the file LICENSE.
+# Author: Pavel Kirienko <pavel.kirienko@zubax.com>
+#
+# Builds and runs the host tests and benchmarks of the libraries, using the host stand-ins of the ChibiOS headers
+# from include/. The tests fail loudly; the benchmarks print their results.
+#
+# Usage: ./run.sh [name-filter]
+# The compiler can be overridden via CXX. The binaries are placed into build/ next to this script.
+#
+
+function die()
+{
+    echo "$@" 1>&2
+    exit 1
+}
+
+cd "$(dirname "$0")" || die "Could not enter the script directory"
+
+ROOT=../..
+CXX=${CXX:-g++}
+FLAGS="-std=c++17 -O2 -Wall -Wextra -Werror -Wundef -pthread -DRELEASE_BUILD=1 -Iinclude -I$ROOT"
+FILTER="$1"
+
+CONFIG_SRC=$ROOT/zubax_chibios/config/config.cpp
+
+mkdir -p build || die "Could not create the build directory"
+
+# Usage: run <name> <sources and extra flags...>
+function run()
+{
+    local name=$1
+    shift
+    [[ -z "$FILTER" || "$name" == *$FILTER* ]] || return 0
+
+    echo "--- $name"
+    $CXX $FLAGS "$@" -o build/$name || die "$name: build failed"
+    ./build/$name || die "$name: FAILED"
+}
+
+SPARSE_FLAGS="-DCONFIG_STORAGE_JOURNAL=1 -DCONFIG_SPARSE_OVERRIDES_MAX=16"
+
+for num_params in 40 200 1000
+do
+    run config_access_benchmark_$num_params config_access_benchmark.cpp $CONFIG_SRC \
+        -DNDEBUG -DCONFIG_PARAMS_MAX=$num_params
+    run config_access_benchmark_sparse_$num_params config_access_benchmark.cpp $CONFIG_SRC \
+        -DNDEBUG -DCONFIG_PARAMS_MAX=$num_params $SPARSE_FLAGS
+done
+
+run config_seqlock_stress_test config_seqlock_stress_test.cpp $CONFIG_SRC
+run config_seqlock_stress_test_sparse config_seqlock_stress_test.cpp $CONFIG_SRC $SPARSE_FLAGS
+
+for journal in 0 1
+do
+    run config_storage_benchmark_$journal config_storage_benchmark.cpp $CONFIG_SRC \
+        -DNDEBUG -DCONFIG_STORAGE_JOURNAL=$journal
+done
+
+for journal in 0 1
+do
+    run config_static_registry_test_$journal config_static_registry_test.cpp $CONFIG_SRC \
+        -DCONFIG_STATIC_REGISTRY=1 -DCONFIG_STORAGE_JOURNAL=$journal
+done
+
+run config_transaction_benchmark config_transaction_benchmark.cpp $CONFIG_SRC -DNDEBUG -DCONFIG_PARAMS_MAX=50
+
+run config_set_benchmark config_set_benchmark.cpp $CONFIG_SRC -DNDEBUG
+run config_set_benchmark_sparse config_set_benchmark.cpp $CONFIG_SRC -DNDEBUG $SPARSE_FLAGS
+
+run flash_engine_benchmark flash_engine_benchmark.cpp $ROOT/zubax_chibios/platform/stm32/flash_engine_stm32.cpp \
+    -DHOST_FPEC_MODEL -DFLASH_WRITER_BOUNDED_LATENCY=1 -DFLASH_ENGINE_STACK_SIZE=1024
+
+for slices in 0 1 4 8
+do
+    run crc64we_benchmark_$slices crc64we_benchmark.cpp -DNDEBUG -DBOOTLOADER_CRC64WE_SLICES=$slices
+done
+
+for readback in 0 1
+do
+    run bootloader_upgrade_benchmark_$readback bootloader_upgrade_benchmark.cpp \
+        -DNDEBUG -DBOOTLOADER_CRC64WE_SLICES=8 -DBOOTLOADER_READBACK_VERIFY=$readback
+done
+
+echo "All done"
@@ -11,10 +11,21 @@
 #include <cstdint>
 #include <utility>
 #include <array>
+#include <algorithm>
 #include <cassert>
+#include <cstring>
 #include <optional>
 #include "util.hpp"
 
+/*
+ * The CRC of the application image is computed while the image is being downloaded, so that the storage need not
+ * be read back once the download is finished. If this option is enabled, the image is verified by reading it back
+ * from the storage instead, which also detects the data that was corrupted by the storage.
+ */
+#ifndef BOOTLOADER_READBACK_VERIFY
+#  define BOOTLOADER_READBACK_VERIFY    0
+#endif
+
 
 namespace os
 {
@@ -132,6 +143,203 @@ public:
  */
 class Bootloader
 {
+    State state_;
+    IAppStorageBackend& backend_;
+
+    const std::uint32_t max_application_image_size_;
+    const unsigned boot_delay_msec_;
+    ::systime_t boot_delay_started_at_st_;
+
+    std::uint8_t rom_buffer_[1024];             ///< Larger buffer enables faster CRC verification, which is important
+
+    chibios_rt::Mutex mutex_;
+
+    /// Caching is needed because app check can sometimes take a very long time (several seconds)
+    std::optional<AppInfo> cached_app_info_;
+
+    /**
+     * Refer to the Brickproof Bootloader specs.
+     * Note that the structure must be aligned at 8 bytes boundary, and the image must be padded to 8 bytes!
+     */
+    struct __attribute__((packed)) AppDescriptor
+    {
+        static constexpr unsigned ImagePaddingBytes = 8;
+
+        std::array<std::uint8_t, 8> signature;
+        AppInfo app_info;
+        std::array<std::uint8_t, 6> reserved;
+
+        static constexpr std::array<std::uint8_t, 8> getSignatureValue()
+        {
+            return {'A','P','D','e','s','c','0','0'};
+        }
+
+        bool isValid(const std::uint32_t max_application_image_size) const
+        {
+            const auto sgn = getSignatureValue();
+            return std::equal(std::begin(signature), std::end(signature), std::begin(sgn)) &&
+                   (app_info.image_size > 0) &&
+                   (app_info.image_size <= max_application_image_size) &&
+                   ((app_info.image_size % ImagePaddingBytes) == 0);
+        }
+    };
+    static_assert(sizeof(AppDescriptor) == 32, "Invalid packing");
+
+    /**
+     * Locates the app descriptor and computes the CRC of the image in the download stream, the same way as
+     * locateAppDescriptor() does it on the storage. The stream is processed in blocks of 8 bytes, because
+     * the descriptor is aligned at 8 bytes.
+     * Every block that carries the signature starts a candidate descriptor; a candidate inherits the CRC of the
+     * preceding data, the CRC field is substituted with zeros, and the candidate is complete once the end of its
+     * image is reached.
+     */
+    class StreamingAppVerifier
+    {
+        static constexpr unsigned BlockSize = 8;
+        static constexpr unsigned MaxCandidates = 2;
+        static constexpr std::size_t CRCOffset = offsetof(AppDescriptor, app_info.image_crc);
+        static_assert((CRCOffset == BlockSize) && (sizeof(AppInfo::image_crc) == 8),
+                      "The CRC field must occupy exactly the second block of the descriptor");
+
+        struct Candidate
+        {
+            std::size_t offset = 0;
+            AppDescriptor descriptor;
+            CRC64WE crc;
+            bool active = false;
+        };
+
+        const std::size_t max_image_size_;
+        std::size_t offset_ = 0;
+        std::uint8_t block_[BlockSize] = {};
+        CRC64WE crc_;
+        Candidate candidates_[MaxCandidates];
+        std::size_t found_offset_ = 0;
+        AppDescriptor found_descriptor_;
+        bool found_ = false;
+        bool overflow_ = false;
+
+        void complete(Candidate& c)
+        {
+            c.active = false;
+            if ((c.crc.get() == c.descriptor.app_info.image_crc) && (!found_ || (c.offset < found_offset_)))
+            {
+                found_offset_ = c.offset;
+                found_descriptor_ = c.descriptor;
+                found_ = true;
+            }
+        }
+
+        void processCandidate(Candidate& c, const std::size_t position)
+        {
+            const std::size_t relative = position - c.offset;
+            if (relative < sizeof(AppDescriptor))
+            {
+                std::memcpy(reinterpret_cast<std::uint8_t*>(&c.descriptor) + relative, block_, BlockSize);
+                if ((relative + BlockSize) < sizeof(AppDescriptor))
+                {
+                    return;
+                }
+                if (!c.descriptor.isValid(max_image_size_))
+                {
+                    c.active = false;
+                    return;
+                }
+                // The rest of the descriptor past the CRC field, unless the image ends before
+                const std::size_t image_size = c.descriptor.app_info.image_size;
+                const std::size_t begin = c.offset + CRCOffset + sizeof(c.descriptor.app_info.image_crc);
+                const std::size_t end = std::min(image_size, c.offset + sizeof(AppDescriptor));
+                if (end > begin)
+                {
+                    c.crc.add(reinterpret_cast<const std::uint8_t*>(&c.descriptor) + (begin - c.offset),
+                              unsigned(end - begin));
+                }
+            }
+            else
+            {
+                c.crc.add(block_, BlockSize);
+            }
+
+            if ((position + BlockSize) >= c.descriptor.app_info.image_size)
+            {
+                complete(c);
+            }
+        }
+
+        void processBlock(const std::size_t position)
+        {
+            for (Candidate& c : candidates_)
+            {
+                if (c.active)
+                {
+                    processCandidate(c, position);
+                }
+            }
+
+            crc_.add(block_, BlockSize);
+
+            const auto signature = AppDescriptor::getSignatureValue();
+            if (std::equal(std::begin(signature), std::end(signature), std::begin(block_)))
+            {
+                Candidate* const c = std::find_if(std::begin(candidates_), std::end(candidates_),
+                                                  [](const Candidate& x) { return !x.active; });
+                if (c == std::end(candidates_))
+                {
+                    overflow_ = true;
+                    return;
+                }
+                static const std::uint8_t dummy[8]{0};
+                c->offset = position;
+                c->crc = crc_;
+                c->crc.add(&dummy[0], sizeof(dummy));
+                std::memcpy(reinterpret_cast<std::uint8_t*>(&c->descriptor), block_, BlockSize);
+                c->active = true;
+            }
+        }
+
+    public:
+        explicit StreamingAppVerifier(std::size_t max_image_size) : max_image_size_(max_image_size) { }
+
+        void add(const void* data, std::size_t size)
+        {
+            const std::uint8_t* bytes = static_cast<const std::uint8_t*>(data);
+            while (size > 0)
+            {
+                const std::size_t in_block = offset_ % BlockSize;
+                const std::size_t amount = std::min<std::size_t>(size, BlockSize - in_block);
+                std::memcpy(&block_[in_block], bytes, amount);
+                bytes += amount;
+                size -= amount;
+                offset_ += amount;
+                if ((offset_ % BlockSize) == 0)
+                {
+                    processBlock(offset_ - BlockSize);
+                }
+            }
+        }
+
+        /**
+         * Returns false if the descriptor was not found, or if the result is ambiguous and the storage should
+         * be checked instead: too many candidates, or a candidate that precedes the found one is not complete.
+         */
+        bool getAppDescriptor(AppDescriptor& out_descriptor) const
+        {
+            if (!found_ || overflow_)
+            {
+                return false;
+            }
+            for (const Candidate& c : candidates_)
+            {
+                if (c.active && (c.offset < found_offset_))
+                {
+                    return false;
+                }
+            }
+            out_descriptor = found_descriptor_;
+            return true;
+        }
+    };
+
     /**
      * A proxy that streams the data from the downloader into the application storage.
      * Note that every access to the storage backend is protected with the mutex!
@@ -142,6 +350,7 @@ class Bootloader
         chibios_rt::Mutex& mutex_;
         const std::size_t max_image_size_;
         std::size_t offset_ = 0;
+        StreamingAppVerifier verifier_;
 
         int handleNextDataChunk(const void* data, std::size_t size) override
         {
@@ -155,6 +364,11 @@ class Bootloader
                     return -ErrAppStorageWriteFailure;
                 }
 
+                if (res >= 0)
+                {
+                    verifier_.add(data, size);
+                }
+
                 offset_ += size;
                 return res;
             }
@@ -170,51 +384,18 @@ class Bootloader
              std::size_t max_image_size) :
             backend_(back),
             mutex_(mutex),
-            max_image_size_(max_image_size)
+            max_image_size_(max_image_size),
+            verifier_(max_image_size)
         { }
-    };
 
-    State state_;
-    IAppStorageBackend& backend_;
-
-    const std::uint32_t max_application_image_size_;
-    const unsigned boot_delay_msec_;
-    ::systime_t boot_delay_started_at_st_;
-
-    std::uint8_t rom_buffer_[1024];             ///< Larger buffer enables faster CRC verification, which is important
-
-    chibios_rt::Mutex mutex_;
-
-    /// Caching is needed because app check can sometimes take a very long time (several seconds)
-    std::optional<AppInfo> cached_app_info_;
-
-    /**
-     * Refer to the Brickproof Bootloader specs.
-     * Note that the structure must be aligned at 8 bytes boundary, and the image must be padded to 8 bytes!
-     */
-    struct __attribute__((packed)) AppDescriptor
-    {
-        static constexpr unsigned ImagePaddingBytes = 8;
-
-        std::array<std::uint8_t, 8> signature;
-        AppInfo app_info;
-        std::array<std::uint8_t, 6> reserved;
-
-        static constexpr std::array<std::uint8_t, 8> getSignatureValue()
+        /**
+         * See StreamingAppVerifier::getAppDescriptor().
+         */
+        bool getAppDescriptor(AppDescriptor& out_descriptor) const
         {
-            return {'A','P','D','e','s','c','0','0'};
-        }
-
-        bool isValid(const std::uint32_t max_application_image_size) const
-        {
-            const auto sgn = getSignatureValue();
-            return std::equal(std::begin(signature), std::end(signature), std::begin(sgn)) &&
-                   (app_info.image_size > 0) &&
-                   (app_info.image_size <= max_application_image_size) &&
-                   ((app_info.image_size % ImagePaddingBytes) == 0);
+            return verifier_.getAppDescriptor(out_descriptor);
         }
     };
-    static_assert(sizeof(AppDescriptor) == 32, "Invalid packing");
 
     std::pair<AppDescriptor, bool> locateAppDescriptor()
     {
@@ -312,8 +493,11 @@ class Bootloader
 
     void verifyAppAndUpdateState(const State state_on_success)
     {
-        const auto appdesc_result = locateAppDescriptor();
+        updateState(locateAppDescriptor(), state_on_success);
+    }
 
+    void updateState(const std::pair<AppDescriptor, bool>& appdesc_result, const State state_on_success)
+    {
         if (appdesc_result.second)
         {
             cached_app_info_ = appdesc_result.first.app_info;
@@ -525,7 +709,17 @@ public:
          * Everything went well, checking if the application is valid and updating the state accordingly.
          * This method will report success even if the application image it just downloaded is not valid,
          * since that would be out of the scope of its responsibility.
+         * The storage is checked only if the application could not be found in the download stream.
          */
+#if !BOOTLOADER_READBACK_VERIFY
+        AppDescriptor desc;
+        if (sink.getAppDescriptor(desc))
+        {
+            DEBUG_LOG("App verified in the download stream\n");
+            updateState({desc, true}, State::BootDelay);
+            return ErrOK;
+        }
+#endif
         verifyAppAndUpdateState(State::BootDelay);
 
         return ErrOK;
@@ -9,6 +9,21 @@
 #include <zubax_chibios/os.hpp>
 #include <cstdint>
 #include <cassert>
+#include <array>
+
+/*
+ * The CRC64WE implementation: 0 - bit-serial, no tables (default, the smallest ROM footprint);
+ * 1 - one 256-entry table (2 KiB of ROM); 4 or 8 - slicing-by-4 or slicing-by-8 (8 or 16 KiB of ROM).
+ * The tables are generated at compile time. On 32-bit cores, slicing-by-4 is usually the best choice.
+ */
+#ifndef BOOTLOADER_CRC64WE_SLICES
+#  define BOOTLOADER_CRC64WE_SLICES     0
+#endif
+
+#if (BOOTLOADER_CRC64WE_SLICES != 0) && (BOOTLOADER_CRC64WE_SLICES != 1) && \
+    (BOOTLOADER_CRC64WE_SLICES != 4) && (BOOTLOADER_CRC64WE_SLICES != 8)
+# error "BOOTLOADER_CRC64WE_SLICES must be 0, 1, 4, or 8"
+#endif
 
 
 namespace os
@@ -24,11 +39,43 @@ static constexpr std::int16_t ErrInvalidState           = 10001;
 static constexpr std::int16_t ErrAppImageTooLarge       = 10002;
 static constexpr std::int16_t ErrAppStorageWriteFailure = 10003;
 
+#if BOOTLOADER_CRC64WE_SLICES > 0
+namespace _internal
+{
+/**
+ * Table 0 holds the CRC of every byte value; table K advances the entries of table K-1 by one more zero byte.
+ */
+template <unsigned NumTables>
+constexpr std::array<std::array<std::uint64_t, 256>, NumTables> makeCRC64WETables(const std::uint64_t poly)
+{
+    std::array<std::array<std::uint64_t, 256>, NumTables> tables{};
+    for (unsigned i = 0; i < 256; i++)
+    {
+        std::uint64_t crc = std::uint64_t(i) << 56;
+        for (unsigned bit = 0; bit < 8; bit++)
+        {
+            crc = ((crc >> 63) != 0) ? (crc << 1) ^ poly : crc << 1;
+        }
+        tables[0][i] = crc;
+    }
+    for (unsigned k = 1; k < NumTables; k++)
+    {
+        for (unsigned i = 0; i < 256; i++)
+        {
+            tables[k][i] = (tables[k - 1][i] << 8) ^ tables[0][tables[k - 1][i] >> 56];
+        }
+    }
+    return tables;
+}
+}
+#endif
+
 /**
  * This is used to verify integrity of the application and other data.
  * Note that firmware CRC verification is a very computationally intensive process that needs to be completed
- * in a limited time interval, which should be minimized. Therefore, this class has been carefully manually
- * optimized to achieve the optimal balance between speed and ROM footprint.
+ * in a limited time interval, which should be minimized. The default bit-serial implementation has been carefully
+ * manually optimized to achieve the optimal balance between speed and ROM footprint; the table-driven ones are
+ * several times faster at the cost of ROM, see BOOTLOADER_CRC64WE_SLICES.
  *
  * CRC-64-WE
  * Description: http://reveng.sourceforge.net/crc-catalogue/17plus.htm#crc.cat-bits.64
@@ -45,11 +92,51 @@ class CRC64WE
 
     std::uint64_t crc_ = 0xFFFFFFFFFFFFFFFFULL;
 
+#if BOOTLOADER_CRC64WE_SLICES > 0
+    static constexpr auto Tables = _internal::makeCRC64WETables<BOOTLOADER_CRC64WE_SLICES>(Poly);
+
+    static std::uint64_t loadBigEndian(const std::uint8_t* bytes, unsigned size)
+    {
+        std::uint64_t out = 0;
+        for (unsigned i = 0; i < size; i++)
+        {
+            out = (out << 8) | bytes[i];
+        }
+        return out;
+    }
+#endif
+
 public:
     void add(const void* data, unsigned len)
     {
         auto bytes = static_cast<const std::uint8_t*>(data);
         assert(bytes != nullptr);
+
+#if BOOTLOADER_CRC64WE_SLICES == 8
+        for (; len >= 8; len -= 8, bytes += 8)
+        {
+            const std::uint64_t x = crc_ ^ loadBigEndian(bytes, 8);
+            crc_ = Tables[7][x >> 56]           ^ Tables[6][(x >> 48) & 0xFF] ^
+                   Tables[5][(x >> 40) & 0xFF] ^ Tables[4][(x >> 32) & 0xFF] ^
+                   Tables[3][(x >> 24) & 0xFF] ^ Tables[2][(x >> 16) & 0xFF] ^
+                   Tables[1][(x >> 8) & 0xFF]  ^ Tables[0][x & 0xFF];
+        }
+#elif BOOTLOADER_CRC64WE_SLICES == 4
+        for (; len >= 4; len -= 4, bytes += 4)
+        {
+            const std::uint64_t x = crc_ ^ (loadBigEndian(bytes, 4) << 32);
+            crc_ = (x << 32) ^
+                   Tables[3][x >> 56]           ^ Tables[2][(x >> 48) & 0xFF] ^
+                   Tables[1][(x >> 40) & 0xFF] ^ Tables[0][(x >> 32) & 0xFF];
+        }
+#endif
+
+#if BOOTLOADER_CRC64WE_SLICES > 0
+        while (len --> 0)
+        {
+            crc_ = (crc_ << 8) ^ Tables[0][(crc_ >> 56) ^ *bytes++];
+        }
+#else
         while (len --> 0)
         {
             crc_ ^= std::uint64_t(*bytes++) << 56;
@@ -64,6 +151,7 @@ public:
             crc_ = (crc_ & Mask) ? (crc_ << 1) ^ Poly : crc_ << 1;
             crc_ = (crc_ & Mask) ? (crc_ << 1) ^ Poly : crc_ << 1;
         }
+#endif
     }
 
     std::uint64_t get() const { return crc_ ^ 0xFFFFFFFFFFFFFFFFULL; }
@@ -16,12 +16,18 @@
 #include <cassert>
 #include <cerrno>
 #include <cstring>
+#include <cctype>
 #include <cmath>
 #include <cstdint>
 #include <limits>
+#include <algorithm>
+#include <bitset>
+#include <atomic>
+#include <type_traits>
 #include <zubax_chibios/os.hpp>
 #include "config.hpp"
 #include "config.h"
+#include "static_registry.hpp"
 
 #ifndef CONFIG_PARAMS_MAX
 #  define CONFIG_PARAMS_MAX     40
@@ -31,10 +37,87 @@
 #  define CONFIG_PARAM_MAX_NAME_LENGTH     92    // UAVCAN compliant
 #endif
 
+/*
+ * Size of the pool of non-bool values in bytes; each value takes its native size, e.g. one byte for uint8,
+ * whereas bool values take one bit each and are stored separately. The default accommodates 32-bit values;
+ * it has to be increased if there are 64-bit values, and it can be reduced to save RAM if there are many small ones.
+ */
+#ifndef CONFIG_VALUE_POOL_SIZE
+#  define CONFIG_VALUE_POOL_SIZE        (CONFIG_PARAMS_MAX * 4)
+#endif
+
+/*
+ * See static_registry.hpp. CONFIG_PARAMS_MAX is still used to size the value pool.
+ */
+#ifndef CONFIG_STATIC_REGISTRY
+#  define CONFIG_STATIC_REGISTRY        0
+#endif
+
+/*
+ * Size of the pool of the names of the array elements, like "name[3]", in bytes; see configNameByIndex().
+ * Every element takes the length of the array name plus the subscript and the terminator, e.g. 12 bytes per element
+ * of "cal.tab" with up to 10 elements. It can be reduced to save RAM if there are no arrays.
+ */
+#ifndef CONFIG_ELEMENT_NAME_POOL_SIZE
+#  define CONFIG_ELEMENT_NAME_POOL_SIZE 256
+#endif
+
+/*
+ * Params registered via the C API, array elements included, are not Param<> instances, so getParamMetadata()
+ * constructs a Param<> copy of the descriptor of such a param on the first request. The copies are never released;
+ * once this many are in use, getParamMetadata() returns an empty option for the C params that have none yet.
+ */
+#ifndef CONFIG_C_PARAM_METADATA_MAX
+#  define CONFIG_C_PARAM_METADATA_MAX   8
+#endif
+
+/*
+ * The journaled storage format appends only the changed values to the storage; the storage is erased only when
+ * it is full. This requires the storage backend to report its size and to allow programming of the erased space
+ * without erasing it again, which is the case for NOR flash.
+ * The full image format is used otherwise, where every save erases the storage and rewrites all of the values.
+ */
+#ifndef CONFIG_STORAGE_JOURNAL
+#  define CONFIG_STORAGE_JOURNAL        0
+#endif
+
+/*
+ * Maximum number of config domains, see os::config::Domain.
+ */
+#ifndef CONFIG_DOMAINS_MAX
+#  define CONFIG_DOMAINS_MAX            1
+#endif
+
+/*
+ * Sparse storage of the values for RAM-constrained targets, enabled if non-zero: only the values that differ from
+ * the defaults (overrides) are kept in RAM, in a table of this many 32-bit words sorted by param index; a 64-bit
+ * value takes two words. The defaults are taken from the descriptors, and the value pools are not allocated.
+ * Reading a value costs a binary search instead of an array access, and setting a value fails with -ENOSPC if the
+ * table is full. This requires the journaled storage format, which persists only the overrides.
+ * If the stored values do not fit the table, init() returns -ENOSPC; see os::config::init().
+ */
+#ifndef CONFIG_SPARSE_OVERRIDES_MAX
+#  define CONFIG_SPARSE_OVERRIDES_MAX   0
+#endif
+
+#if (CONFIG_SPARSE_OVERRIDES_MAX > 0) && !CONFIG_STORAGE_JOURNAL
+#  error "CONFIG_SPARSE_OVERRIDES_MAX requires CONFIG_STORAGE_JOURNAL"
+#endif
+
+/*
+ * Stack size of the background thread that serves os::config::saveAsync(); zero disables the thread.
+ */
+#ifndef CONFIG_ASYNC_SAVE_STACK_SIZE
+#  define CONFIG_ASYNC_SAVE_STACK_SIZE  0
+#endif
+
 #define OFFSET_LAYOUT_HASH      0
 #define OFFSET_CRC              4
 #define OFFSET_VALUES           8
 
+#define OFFSET_JOURNAL_MAGIC    4
+#define OFFSET_JOURNAL_RECORDS  8
+
 using namespace os::config;
 
 
@@ -45,31 +128,296 @@ static constexpr int InitCodeCRCMismatch    = 3;
 static constexpr int MaxRetries = 3;
 
 
+/*
+ * Values are stored in their native types. The value pool is ordered by the value size, so there is no padding;
+ * bool values are packed into the bit pool. The slot of a param is the byte offset of its value in the value pool,
+ * or the bit number in the bit pool; the slots are assigned once during initialization.
+ * Every domain occupies a word-aligned range of each pool.
+ * In the sparse mode the pools are not allocated, but the slots still define the layout of the stored image and
+ * of the snapshot.
+ */
+static constexpr std::size_t ValuePoolSize = (CONFIG_VALUE_POOL_SIZE + 3) / 4 * 4;
+static constexpr std::size_t BitPoolSize = ((CONFIG_PARAMS_MAX + 31) / 32 + CONFIG_DOMAINS_MAX - 1) * 4;
+
+#if CONFIG_SPARSE_OVERRIDES_MAX > 0
+using OverrideKey = std::conditional_t<(CONFIG_PARAMS_MAX <= 256), std::uint8_t, std::uint16_t>;
+static OverrideKey _override_keys[CONFIG_SPARSE_OVERRIDES_MAX];         ///< Param indexes, sorted
+static std::uint32_t _override_values[CONFIG_SPARSE_OVERRIDES_MAX];     ///< 64-bit values: low word first
+static std::size_t _num_overrides = 0;
+static unsigned _num_dropped_overrides = 0;                             ///< Values that were restored without room
+#else
+static std::uint32_t _value_pool[ValuePoolSize / 4];
+static std::uint32_t _bit_pool[BitPoolSize / 4];
+#endif
+
+using Slot = std::conditional_t<(ValuePoolSize <= 256) && (BitPoolSize * 8U <= 256), std::uint8_t, std::uint16_t>;
+static Slot _slots[CONFIG_PARAMS_MAX];
+
+/**
+ * Range of the value pool and of the bit pool; all fields are in bytes, multiple of 4.
+ */
+struct PoolRange
+{
+    std::size_t values_offset;
+    std::size_t values_size;
+    std::size_t bits_offset;
+    std::size_t bits_size;
+};
+
+static PoolRange _pool_used{};
+
+/**
+ * Native type of the value. The numeric values are a part of the storage format, they must never change.
+ */
+enum class Kind : std::uint8_t
+{
+    Bit     = 0,
+    Float32 = 1,
+    UInt8   = 2,
+    Int8    = 3,
+    UInt16  = 4,
+    Int16   = 5,
+    UInt32  = 6,
+    Int32   = 7,
+    UInt64  = 8,
+    Int64   = 9
+};
+
+/*
+ * Validation table built when the descriptor set is frozen at init(), so that the set path does not have to
+ * interpret the descriptors. The limits are raw values of the native type clamped to its range, except for the
+ * 64-bit integers, whose limits are float, as in the descriptor; they can't be more precise anyway.
+ */
+struct Limits
+{
+    std::uint32_t min;
+    std::uint32_t max;
+};
+
+static Limits _limits[CONFIG_PARAMS_MAX];
+static Kind _kinds[CONFIG_PARAMS_MAX];
+
+/*
+ * Storage format version 1 stored all values as float in a full image, and the stored hash was the layout hash
+ * as is; it is still supported for reading. Version 2 stores the values in their native types, either as a full
+ * image or as a journal, and the stored hash is the layout hash extended with the format version and the native
+ * types of the values.
+ */
+static constexpr std::uint8_t FormatVersion = 2;
+
+#if CONFIG_STATIC_REGISTRY
+extern const os::config::StaticRegistryView _config_static_registry;
+
+static inline int numParams()                       { return int(_config_static_registry.num_params); }
+static inline const ConfigParam* descr(int index)   { return _config_static_registry.params[index]; }
+static inline std::uint32_t layoutHash(int domain)  { return _config_static_registry.layout_hashes[domain]; }
+#else
 static const ConfigParam* _descr_pool[CONFIG_PARAMS_MAX];
-static float _value_pool[CONFIG_PARAMS_MAX];
+
+static std::bitset<CONFIG_PARAMS_MAX> _typed_params;     ///< Set for the params registered via Param<>
+
+static_assert(CONFIG_ELEMENT_NAME_POOL_SIZE > 0, "CONFIG_ELEMENT_NAME_POOL_SIZE must be positive");
+using ElementNameOffset = std::conditional_t<(CONFIG_ELEMENT_NAME_POOL_SIZE <= 256), std::uint8_t, std::uint16_t>;
+static char _element_names[CONFIG_ELEMENT_NAME_POOL_SIZE];
+static std::size_t _element_names_used = 0;
+static ElementNameOffset _element_name_offsets[CONFIG_PARAMS_MAX];   ///< Used only for the array elements
 
 static int _num_params = 0;
-static std::uint32_t _layout_hash = 0;
+static std::uint32_t _layout_hashes[CONFIG_DOMAINS_MAX];
+
+static inline int numParams()                       { return _num_params; }
+static inline const ConfigParam* descr(int index)   { return _descr_pool[index]; }
+static inline std::uint32_t layoutHash(int domain)  { return _layout_hashes[domain]; }
+#endif
+
+/**
+ * Every element of an array param has its own index and the descriptor of the array; see configNameByIndex().
+ */
+static inline int numElements(int index)            { return std::max(1, int(descr(index)->length)); }
+
+static std::uint32_t _snapshot_hash = 0;        ///< Identifies the format of all domains, see exportSnapshot()
+
 static bool _frozen = false;
 
+/*
+ * Readers never lock anything. Every value is loaded atomically, and multi-param snapshots are made consistent
+ * using the sequence counter below (seqlock): it is odd while a modification is in progress.
+ * Writers serialize among themselves via the mutex, which may also be held for a long time while the storage is
+ * being accessed; this does not affect readers.
+ * Modifications are performed in critical sections, otherwise a high priority reader could spin forever waiting
+ * for a preempted low priority writer to make the counter even again.
+ */
 static chibios_rt::Mutex _mutex;
+static std::atomic<unsigned> _write_seq{0};
 
 static unsigned _modification_cnt = 0;
 
-static IStorageBackend* g_storage = nullptr;
+/*
+ * Params whose values were modified since they were last saved or restored. Protected by the mutex.
+ * The counter is kept separately to allow lock-free queries.
+ */
+static std::bitset<CONFIG_PARAMS_MAX> _dirty;
+static unsigned _num_dirty = 0;
+
+/*
+ * Change subscriptions, protected by the mutex. The bitmask allows to skip the params nobody is subscribed to.
+ */
+static _internal::ChangeSubscriptionBase* _subscriptions = nullptr;
+static std::bitset<CONFIG_PARAMS_MAX> _subscribed;
+
+/*
+ * Serializes the storage access; the long storage operations that don't need the values are performed holding
+ * only this mutex, so that the setters are not blocked. If both are needed, the main mutex must be taken first.
+ */
+static chibios_rt::Mutex _storage_mutex;
+
+/*
+ * Access statistics, see CONFIG_INSTRUMENTATION; the hooks below compile to nothing if it is disabled.
+ * The counters that are updated on the lock-free read paths are incremented atomically; the rest is protected
+ * by the mutex.
+ */
+#if CONFIG_INSTRUMENTATION
+static ParamAccessCounters _access_counters[CONFIG_PARAMS_MAX];
+static AccessStatistics _access_stats;
+
+static inline void countAtomically(std::uint32_t& counter)
+{
+    __atomic_fetch_add(&counter, 1U, __ATOMIC_RELAXED);
+}
+
+static inline void countGet(int index) { countAtomically(_access_counters[index].gets); }
 
+static inline void countSet(int index) { countAtomically(_access_counters[index].sets); }
 
-static std::uint32_t crc32_step(std::uint32_t crc, std::uint8_t new_byte)
+static void countLookup(int index, unsigned comparisons)
 {
-    crc = crc ^ (std::uint32_t)new_byte;
-    for (int j = 7; j >= 0; j--)
+    if (index >= 0)
     {
-        crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+        countAtomically(_access_counters[index].lookups);
     }
-    return crc;
+    unsigned bucket = 0;
+    while ((comparisons > 1U) && (bucket < (AccessStatistics::LookupCostHistogramSize - 1U)))
+    {
+        comparisons >>= 1U;
+        bucket++;
+    }
+    countAtomically(_access_stats.lookup_cost_histogram[bucket]);
+}
+
+static std::uint32_t accumulateDuration(std::uint32_t& total, ::systime_t started_at)
+{
+    const auto duration = std::uint32_t(chVTTimeElapsedSinceX(started_at));
+    total += duration;
+    return duration;
+}
+
+/**
+ * Counts the waits for the mutex; the statistics are updated when the mutex is taken already.
+ */
+class ConfigMutexLocker
+{
+    chibios_rt::Mutex& mutex_;
+
+public:
+    explicit ConfigMutexLocker(chibios_rt::Mutex& mutex) :
+        mutex_(mutex)
+    {
+        std::uint32_t wait = 0;
+        if (!mutex_.tryLock())
+        {
+            const ::systime_t started_at = chVTGetSystemTimeX();
+            mutex_.lock();
+            wait = accumulateDuration(_access_stats.lock_wait_total, started_at);
+            _access_stats.contended_locks++;
+        }
+        _access_stats.locks++;
+        _access_stats.lock_wait_max = std::max(_access_stats.lock_wait_max, wait);
+    }
+
+    ~ConfigMutexLocker() { mutex_.unlock(); }
+};
+#else
+static inline void countGet(int) { }
+static inline void countSet(int) { }
+static inline void countLookup(int, unsigned) { }
+
+using ConfigMutexLocker = os::MutexLocker;
+#endif
+
+static int eraseStorage(IStorageBackend* storage)
+{
+#if CONFIG_INSTRUMENTATION
+    const ::systime_t started_at = chVTGetSystemTimeX();
+    const int res = storage->erase();
+    (void)accumulateDuration(_access_stats.erase_duration_total, started_at);
+    return res;
+#else
+    return storage->erase();
+#endif
+}
+
+static int writeStorage(IStorageBackend* storage, std::size_t offset, const void* data, std::size_t len)
+{
+#if CONFIG_INSTRUMENTATION
+    const ::systime_t started_at = chVTGetSystemTimeX();
+    const int res = storage->write(offset, data, len);
+    (void)accumulateDuration(_access_stats.program_duration_total, started_at);
+    return res;
+#else
+    return storage->write(offset, data, len);
+#endif
 }
 
-static std::uint32_t crc32(const void* data, int len)
+#if CONFIG_STORAGE_JOURNAL
+static constexpr std::uint32_t JournalMagic = 0x4A474643;       // "CFGJ"
+
+/**
+ * Journal entry; the storage contains a sequence of these after the header, the latest entry for a param wins.
+ * The value is stored in its native type; the second word is stored only if the value is 64-bit.
+ * Erased (all ones) entry marks the end of the journal.
+ */
+struct JournalRecord
+{
+    static constexpr std::size_t HeaderSize = 4;
+
+    std::uint16_t index;
+    std::uint16_t check;        ///< Detects records that were not programmed completely, e.g. due to power loss
+    std::uint32_t value[2];
+
+    std::uint16_t computeCheck(std::size_t value_size) const;
+
+    bool isErased() const
+    {
+        return (index == 0xFFFF) && (check == 0xFFFF);
+    }
+};
+static_assert(sizeof(JournalRecord) == 12, "Invalid journal record layout");
+#endif
+
+/*
+ * Every domain is kept in its own storage, the stored image of a domain contains only the values of its params.
+ * The params are identified in the storage by their local index, that is the index among the params of the domain,
+ * so that the stored data of a domain does not depend on the params of the other domains.
+ */
+struct DomainState
+{
+    IStorageBackend* storage = nullptr;
+    const char* name = nullptr;
+    std::bitset<CONFIG_PARAMS_MAX> params;
+    PoolRange range{};
+    std::uint32_t format_hash = 0;          ///< Stored hash of the current format, see FormatVersion
+#if CONFIG_STORAGE_JOURNAL
+    std::size_t journal_end = 0;            ///< Zero if the storage does not contain a valid journal
+#endif
+#if CONFIG_SPARSE_OVERRIDES_MAX > 0
+    bool incomplete = false;                ///< Some stored values did not fit the override table; see init()
+#endif
+};
+
+static DomainState _domains[CONFIG_DOMAINS_MAX];
+
+
+static std::uint32_t crc32(const void* data, int len, std::uint32_t crc = 0)
 {
     assert(data && len >= 0);
     if (!data)
@@ -77,24 +425,160 @@ static std::uint32_t crc32(const void* data, int len)
         return 0;
     }
 
-    std::uint32_t crc = 0;
     for (int i = 0; i < len; i++)
     {
-        crc = crc32_step(crc, *(((const std::uint8_t*)data) + i));
+        crc = _internal::crc32Step(crc, *(((const std::uint8_t*)data) + i));
     }
     return crc;
 }
 
-static bool isValid(const ConfigParam* descr, float value)
+#if CONFIG_STORAGE_JOURNAL
+std::uint16_t JournalRecord::computeCheck(std::size_t value_size) const
 {
-    assert(descr);
+    return std::uint16_t(crc32(value, int(value_size), crc32(&index, sizeof(index))));
+}
+#endif
 
-    if (!std::isfinite(value))
+static Kind kindOf(const ConfigParam* descr)
+{
+    switch (descr->type)
     {
-        return false;
+    case CONFIG_TYPE_BOOL:  return Kind::Bit;
+    case CONFIG_TYPE_FLOAT: return Kind::Float32;
+    case CONFIG_TYPE_INT:
+    {
+        switch (descr->storage)
+        {
+        case CONFIG_STORAGE_UINT8:  return Kind::UInt8;
+        case CONFIG_STORAGE_INT8:   return Kind::Int8;
+        case CONFIG_STORAGE_UINT16: return Kind::UInt16;
+        case CONFIG_STORAGE_INT16:  return Kind::Int16;
+        case CONFIG_STORAGE_UINT32: return Kind::UInt32;
+        case CONFIG_STORAGE_UINT64: return Kind::UInt64;
+        case CONFIG_STORAGE_INT64:  return Kind::Int64;
+        case CONFIG_STORAGE_AUTO:
+        case CONFIG_STORAGE_INT32:
+        default:                    return Kind::Int32;
+        }
+    }
+    default:
+    {
+        assert(0);
+        return Kind::Float32;
+    }
+    }
+}
+
+template <typename T>
+static constexpr Kind kindOf()
+{
+    if constexpr (std::is_same_v<T, bool>)          { return Kind::Bit; }
+    if constexpr (std::is_same_v<T, float>)         { return Kind::Float32; }
+    if constexpr (std::is_same_v<T, std::uint8_t>)  { return Kind::UInt8; }
+    if constexpr (std::is_same_v<T, std::int8_t>)   { return Kind::Int8; }
+    if constexpr (std::is_same_v<T, std::uint16_t>) { return Kind::UInt16; }
+    if constexpr (std::is_same_v<T, std::int16_t>)  { return Kind::Int16; }
+    if constexpr (std::is_same_v<T, std::uint32_t>) { return Kind::UInt32; }
+    if constexpr (std::is_same_v<T, std::int32_t>)  { return Kind::Int32; }
+    if constexpr (std::is_same_v<T, std::uint64_t>) { return Kind::UInt64; }
+    return Kind::Int64;
+}
+
+/**
+ * Invokes the visitor with a value of the native type of the specified kind; the value itself is meaningless.
+ */
+template <typename Visitor>
+static auto visitNativeType(Kind kind, Visitor visitor) -> decltype(visitor(float()))
+{
+    switch (kind)
+    {
+    case Kind::Bit:     return visitor(bool());
+    case Kind::UInt8:   return visitor(std::uint8_t());
+    case Kind::Int8:    return visitor(std::int8_t());
+    case Kind::UInt16:  return visitor(std::uint16_t());
+    case Kind::Int16:   return visitor(std::int16_t());
+    case Kind::UInt32:  return visitor(std::uint32_t());
+    case Kind::Int32:   return visitor(std::int32_t());
+    case Kind::UInt64:  return visitor(std::uint64_t());
+    case Kind::Int64:   return visitor(std::int64_t());
+    case Kind::Float32:
+    default:            return visitor(float());
+    }
+}
+
+static std::size_t getValueSize(Kind kind)
+{
+    return visitNativeType(kind, [](auto tag) -> std::size_t
+        {
+            return std::is_same_v<decltype(tag), bool> ? 0 : sizeof(tag);
+        });
+}
+
+/*
+ * Raw value is the bit pattern of the native value, zero-extended to 64 bits.
+ */
+template <typename T>
+static inline std::uint64_t toRaw(T value)
+{
+    if constexpr (std::is_same_v<T, float>)
+    {
+        std::uint32_t out = 0;
+        std::memcpy(&out, &value, sizeof(out));
+        return out;
+    }
+    else if constexpr (sizeof(T) < 8)
+    {
+        return std::uint64_t(value) & ((std::uint64_t(1) << (sizeof(T) * 8U)) - 1U);
+    }
+    else
+    {
+        return std::uint64_t(value);
+    }
+}
+
+template <typename T>
+static inline T fromRaw(std::uint64_t raw)
+{
+    if constexpr (std::is_same_v<T, float>)
+    {
+        const auto bits = std::uint32_t(raw);
+        float out = 0;
+        std::memcpy(&out, &bits, sizeof(out));
+        return out;
+    }
+    else
+    {
+        return T(raw);
     }
+}
+
+template <typename T>
+static inline T fromDouble(double value)
+{
+    if constexpr (std::is_integral_v<T> && !std::is_same_v<T, bool>)
+    {
+        if (value >= double(std::numeric_limits<T>::max()))    // May be not representable exactly
+        {
+            return std::numeric_limits<T>::max();
+        }
+    }
+    return T(value);
+}
+
+static double rawToDouble(Kind kind, std::uint64_t raw)
+{
+    return visitNativeType(kind, [raw](auto tag) { return double(fromRaw<decltype(tag)>(raw)); });
+}
+
+#if !CONFIG_STATIC_REGISTRY
+/**
+ * Used at registration only; see the validation table above.
+ */
+static bool isValid(const ConfigParam* descr, double value)
+{
+    assert(descr);
 
-    if (std::strlen(descr->name) > CONFIG_PARAM_MAX_NAME_LENGTH)
+    if (!std::isfinite(value))
     {
         return false;
     }
@@ -103,7 +587,7 @@ static bool isValid(const ConfigParam* descr, float value)
     {
     case CONFIG_TYPE_BOOL:
     {
-        if ((value < 0.0F) || (value > 1.0F))
+        if ((value < 0.0) || (value > 1.0))
         {
             return false;
         }
@@ -111,7 +595,7 @@ static bool isValid(const ConfigParam* descr, float value)
     }
     case CONFIG_TYPE_INT:
     {
-        if (std::abs(value) >= 16777216.0F)      // 2**32
+        if (!_internal::isWithinIntegerStorageRange(descr->storage, value))
         {
             return false;
         }
@@ -134,348 +618,2387 @@ static bool isValid(const ConfigParam* descr, float value)
     }
     return true;
 }
+#endif
+
+static void freezeValidationTable()
+{
+    for (int i = 0; i < numParams(); i++)
+    {
+        const ConfigParam* const d = descr(i);
+        _kinds[i] = kindOf(d);
+        _limits[i] = visitNativeType(_kinds[i], [d](auto tag)
+            {
+                using T = decltype(tag);
+                if constexpr (std::is_same_v<T, bool>)
+                {
+                    return Limits{ 0, 1 };
+                }
+                else if constexpr (std::is_same_v<T, float>)
+                {
+                    return Limits{ std::uint32_t(toRaw(d->min)), std::uint32_t(toRaw(d->max)) };
+                }
+                else if constexpr (sizeof(T) == 8)
+                {
+                    const float min = std::max(d->min, float(std::numeric_limits<T>::min()));
+                    const float max = std::min(d->max, float(std::numeric_limits<T>::max()));
+                    return Limits{ std::uint32_t(toRaw(min)), std::uint32_t(toRaw(max)) };
+                }
+                else
+                {
+                    const double min = std::max(std::ceil(double(d->min)), double(std::numeric_limits<T>::min()));
+                    const double max = std::min(std::floor(double(d->max)), double(std::numeric_limits<T>::max()));
+                    return Limits{ std::uint32_t(toRaw(T(min))), std::uint32_t(toRaw(T(max))) };
+                }
+            });
+    }
+}
+
+template <typename T>
+static inline double getLimitAsDouble(std::uint32_t raw_limit)
+{
+    if constexpr (sizeof(T) == 8)
+    {
+        return double(fromRaw<float>(raw_limit));
+    }
+    else
+    {
+        return double(fromRaw<T>(raw_limit));
+    }
+}
+
+/**
+ * This is the only check that is needed on the set path; it also rejects NaN.
+ */
+template <typename T>
+static inline bool isWithinLimits(int index, T value)
+{
+    const Limits& limits = _limits[index];
+    if constexpr (sizeof(T) == 8)
+    {
+        return (double(value) >= getLimitAsDouble<T>(limits.min)) && (double(value) <= getLimitAsDouble<T>(limits.max));
+    }
+    else
+    {
+        return (fromRaw<T>(limits.min) <= value) && (value <= fromRaw<T>(limits.max));
+    }
+}
+
+static bool isValidRaw(int index, std::uint64_t raw)
+{
+    return visitNativeType(_kinds[index], [index, raw](auto tag)
+        {
+            return isWithinLimits(index, fromRaw<decltype(tag)>(raw));
+        });
+}
+
+/**
+ * Converts the value into the native type of the param; integers are rounded to the nearest.
+ * Returns false if the value is not valid for the param.
+ */
+static bool makeRaw(int index, double value, std::uint64_t& out_raw)
+{
+    return visitNativeType(_kinds[index], [index, value, &out_raw](auto tag)
+        {
+            using T = decltype(tag);
+            const double rounded = (std::is_integral_v<T> && !std::is_same_v<T, bool>) ? std::round(value) : value;
+
+            // The limits are within the range of the native type, so the comparison also ensures that the
+            // value is representable
+            const Limits& limits = _limits[index];
+            if (!((rounded >= getLimitAsDouble<T>(limits.min)) && (rounded <= getLimitAsDouble<T>(limits.max))))
+            {
+                return false;
+            }
+
+            out_raw = toRaw(fromDouble<T>(rounded));
+            return true;
+        });
+}
+
+/**
+ * The default value was validated during registration, so it is only converted. This is used on the read path in
+ * the sparse mode, hence the shortcut.
+ */
+static std::uint64_t defaultRaw(int index)
+{
+    const double value = descr(index)->default_;
+    return visitNativeType(_kinds[index], [value](auto tag)
+        {
+            using T = decltype(tag);
+            const double rounded = (std::is_integral_v<T> && !std::is_same_v<T, bool>) ? std::round(value) : value;
+            return toRaw(fromDouble<T>(rounded));
+        });
+}
+
+#if CONFIG_SPARSE_OVERRIDES_MAX > 0
+
+static std::size_t getOverrideSize(int index)
+{
+    return (getValueSize(_kinds[index]) > 4) ? 2U : 1U;
+}
+
+/**
+ * Returns the position of the first override of the param, or the position where it would be inserted.
+ */
+static std::size_t findOverride(int index, std::size_t num_overrides)
+{
+    std::size_t low = 0;
+    std::size_t high = num_overrides;
+    while (low < high)
+    {
+        const std::size_t mid = (low + high) / 2U;
+        if (int(__atomic_load_n(&_override_keys[mid], __ATOMIC_RELAXED)) < index)
+        {
+            low = mid + 1U;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+/**
+ * The table is searched in a seqlock read section, because any write may move the overrides.
+ * Therefore this function must not be invoked from a write section.
+ */
+static std::uint64_t loadRaw(int index)
+{
+    for (;;)
+    {
+        const unsigned seq = _internal::beginRead();
+        const std::size_t num_overrides = __atomic_load_n(&_num_overrides, __ATOMIC_RELAXED);
+        const std::size_t pos = findOverride(index, num_overrides);
+        const bool found = (pos < num_overrides) &&
+                           (int(__atomic_load_n(&_override_keys[pos], __ATOMIC_RELAXED)) == index);
+        std::uint64_t out = 0;
+        if (found)
+        {
+            out = __atomic_load_n(&_override_values[pos], __ATOMIC_RELAXED);
+            if ((getOverrideSize(index) > 1) && ((pos + 1U) < CONFIG_SPARSE_OVERRIDES_MAX))
+            {
+                out |= std::uint64_t(__atomic_load_n(&_override_values[pos + 1U], __ATOMIC_RELAXED)) << 32U;
+            }
+        }
+        if (_internal::endRead(seq))
+        {
+            return found ? out : defaultRaw(index);
+        }
+    }
+}
+
+/**
+ * Removes the override if the value equals the default. The caller must ensure that there is room for a new
+ * override, see getOverrideDelta(); otherwise the value is left unchanged.
+ * Readers detect the modification via the write sequence, so the table is modified non-atomically.
+ */
+static void storeRaw(int index, std::uint64_t raw)
+{
+    const std::size_t size = getOverrideSize(index);
+    const std::size_t pos = findOverride(index, _num_overrides);
+    const bool found = (pos < _num_overrides) && (int(_override_keys[pos]) == index);
+    const bool needed = raw != defaultRaw(index);
+
+    if (found && !needed)
+    {
+        std::memmove(&_override_keys[pos], &_override_keys[pos + size],
+                     (_num_overrides - pos - size) * sizeof(_override_keys[0]));
+        std::memmove(&_override_values[pos], &_override_values[pos + size],
+                     (_num_overrides - pos - size) * sizeof(_override_values[0]));
+        _num_overrides -= size;
+    }
+    if (!found && needed)
+    {
+        if ((_num_overrides + size) > CONFIG_SPARSE_OVERRIDES_MAX)
+        {
+            DEBUG_LOG("No room for override %d\n", index);
+            _num_dropped_overrides += 1;
+            return;
+        }
+        std::memmove(&_override_keys[pos + size], &_override_keys[pos],
+                     (_num_overrides - pos) * sizeof(_override_keys[0]));
+        std::memmove(&_override_values[pos + size], &_override_values[pos],
+                     (_num_overrides - pos) * sizeof(_override_values[0]));
+        _num_overrides += size;
+    }
+    if (needed)
+    {
+        for (std::size_t i = 0; i < size; i++)
+        {
+            _override_keys[pos + i] = OverrideKey(index);
+            _override_values[pos + i] = std::uint32_t(raw >> (i * 32U));
+        }
+    }
+}
+
+/**
+ * Returns the change of the number of overrides that storing the value would cause. The caller must hold the mutex.
+ */
+static int getOverrideDelta(int index, std::uint64_t raw)
+{
+    const std::size_t pos = findOverride(index, _num_overrides);
+    const bool found = (pos < _num_overrides) && (int(_override_keys[pos]) == index);
+    const bool needed = raw != defaultRaw(index);
+    return (int(needed) - int(found)) * int(getOverrideSize(index));
+}
+
+static int getFreeOverrides()
+{
+    return int(CONFIG_SPARSE_OVERRIDES_MAX - _num_overrides);
+}
+
+#else
+
+static constexpr int getOverrideDelta(int, std::uint64_t) { return 0; }
+
+static constexpr int getFreeOverrides() { return std::numeric_limits<int>::max(); }
+
+typedef std::uint16_t __attribute__((__may_alias__)) AliasedUInt16;
+
+/**
+ * 64-bit values can't be loaded atomically, so they are read in a seqlock read section.
+ * Therefore this function must not be invoked from a write section.
+ */
+static std::uint64_t loadRaw(int index)
+{
+    const unsigned slot = _slots[index];
+    const auto bytes = reinterpret_cast<const std::uint8_t*>(_value_pool);
+
+    switch (_kinds[index])
+    {
+    case Kind::Bit:
+    {
+        return (__atomic_load_n(&_bit_pool[slot / 32U], __ATOMIC_RELAXED) >> (slot % 32U)) & 1U;
+    }
+    case Kind::UInt8:
+    case Kind::Int8:
+    {
+        return __atomic_load_n(&bytes[slot], __ATOMIC_RELAXED);
+    }
+    case Kind::UInt16:
+    case Kind::Int16:
+    {
+        return __atomic_load_n(reinterpret_cast<const AliasedUInt16*>(&bytes[slot]), __ATOMIC_RELAXED);
+    }
+    case Kind::UInt64:
+    case Kind::Int64:
+    {
+        for (;;)
+        {
+            const unsigned seq = _internal::beginRead();
+            const std::uint64_t out = __atomic_load_n(&_value_pool[slot / 4U], __ATOMIC_RELAXED) |
+                (std::uint64_t(__atomic_load_n(&_value_pool[slot / 4U + 1U], __ATOMIC_RELAXED)) << 32U);
+            if (_internal::endRead(seq))
+            {
+                return out;
+            }
+        }
+    }
+    case Kind::Float32:
+    case Kind::UInt32:
+    case Kind::Int32:
+    default:
+    {
+        return __atomic_load_n(&_value_pool[slot / 4U], __ATOMIC_RELAXED);
+    }
+    }
+}
+
+static void storeRaw(int index, std::uint64_t raw)
+{
+    const unsigned slot = _slots[index];
+    const auto bytes = reinterpret_cast<std::uint8_t*>(_value_pool);
+
+    switch (_kinds[index])
+    {
+    case Kind::Bit:
+    {
+        // Writers are serialized, so the read-modify-write sequence is safe
+        std::uint32_t word = __atomic_load_n(&_bit_pool[slot / 32U], __ATOMIC_RELAXED);
+        word = (raw != 0) ? (word | (1U << (slot % 32U))) : (word & ~(1U << (slot % 32U)));
+        __atomic_store_n(&_bit_pool[slot / 32U], word, __ATOMIC_RELAXED);
+        break;
+    }
+    case Kind::UInt8:
+    case Kind::Int8:
+    {
+        __atomic_store_n(&bytes[slot], std::uint8_t(raw), __ATOMIC_RELAXED);
+        break;
+    }
+    case Kind::UInt16:
+    case Kind::Int16:
+    {
+        __atomic_store_n(reinterpret_cast<AliasedUInt16*>(&bytes[slot]), std::uint16_t(raw), __ATOMIC_RELAXED);
+        break;
+    }
+    case Kind::UInt64:
+    case Kind::Int64:
+    {
+        __atomic_store_n(&_value_pool[slot / 4U], std::uint32_t(raw), __ATOMIC_RELAXED);
+        __atomic_store_n(&_value_pool[slot / 4U + 1U], std::uint32_t(raw >> 32U), __ATOMIC_RELAXED);
+        break;
+    }
+    case Kind::Float32:
+    case Kind::UInt32:
+    case Kind::Int32:
+    default:
+    {
+        __atomic_store_n(&_value_pool[slot / 4U], std::uint32_t(raw), __ATOMIC_RELAXED);
+        break;
+    }
+    }
+}
+
+#endif
+
+static inline int domainOf(int index)
+{
+    return descr(index)->domain;
+}
+
+/**
+ * Assigns the slots in the order of decreasing value size within every domain; returns false if the value pool
+ * is too small.
+ */
+static bool assignSlots()
+{
+    std::size_t offset = 0;
+    unsigned bit = 0;
+    for (DomainState& dom : _domains)
+    {
+        dom.range.values_offset = offset;
+        for (std::size_t size = 8; size > 0; size /= 2)
+        {
+            for (int i = 0; i < numParams(); i++)
+            {
+                if (dom.params[i] && (getValueSize(_kinds[i]) == size))
+                {
+                    _slots[i] = Slot(offset);
+                    offset += size;
+                }
+            }
+        }
+        offset = (offset + 3U) & ~std::size_t(3U);
+        dom.range.values_size = offset - dom.range.values_offset;
+
+        dom.range.bits_offset = bit / 8U;
+        for (int i = 0; i < numParams(); i++)
+        {
+            if (dom.params[i] && (_kinds[i] == Kind::Bit))
+            {
+                _slots[i] = Slot(bit++);
+            }
+        }
+        bit = ((bit + 31U) / 32U) * 32U;
+        dom.range.bits_size = bit / 8U - dom.range.bits_offset;
+    }
+    _pool_used = PoolRange{ 0, offset, 0, bit / 8U };
+
+    DEBUG_LOG("Value pool %u/%u bytes, %u bits\n", unsigned(_pool_used.values_size), unsigned(ValuePoolSize), bit);
+    return (_pool_used.values_size <= ValuePoolSize) && (_pool_used.bits_size <= BitPoolSize);
+}
+
+static std::uint32_t computeFormatHash(int domain)
+{
+    std::uint32_t hash = _internal::crc32Step(layoutHash(domain), FormatVersion);
+    for (int i = 0; i < numParams(); i++)
+    {
+        if (domainOf(i) == domain)
+        {
+            hash = _internal::crc32Step(hash, std::uint8_t(_kinds[i]));
+        }
+    }
+    return hash;
+}
+
+/**
+ * RAII helper that marks the value pool modification window for seqlock readers.
+ * The caller must hold the mutex.
+ */
+class WriteSequenceLocker
+{
+    const os::CriticalSectionLocker locker_;
+
+public:
+    WriteSequenceLocker()
+    {
+        _write_seq.store(_write_seq.load(std::memory_order_relaxed) + 1U, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    ~WriteSequenceLocker()
+    {
+        _write_seq.store(_write_seq.load(std::memory_order_relaxed) + 1U, std::memory_order_release);
+    }
+};
+
+/**
+ * Compares the name of the param with the name of the specified length, which need not be null-terminated.
+ */
+static int compareName(int index, const char* name, std::size_t length)
+{
+    const char* const own_name = descr(index)->name;
+    const int cmp = std::strncmp(own_name, name, length);
+    return (cmp != 0) ? cmp : int(own_name[length] != '\0');
+}
+
+#if CONFIG_STATIC_REGISTRY
+static int indexOfName(const char* name, std::size_t length)
+{
+    const std::uint16_t* const sorted = _config_static_registry.sorted_index;
+    int low = 0;
+    int high = numParams() - 1;
+    unsigned comparisons = 0;
+    while (low <= high)
+    {
+        const int mid = (low + high) / 2;
+        const int cmp = compareName(sorted[mid], name, length);
+        comparisons++;
+        if (cmp == 0)
+        {
+            countLookup(sorted[mid], comparisons);
+            return sorted[mid];
+        }
+        if (cmp < 0)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid - 1;
+        }
+    }
+    countLookup(-1, comparisons);
+    return -1;
+}
+
+static int indexByName(const char* name);
+
+/**
+ * Compatibility shim for the params defined outside of the static registry: the param must be present in the
+ * registry, and it will be mapped onto the registered one.
+ */
+static int registerParamImpl(const ConfigParam* param)
+{
+    ASSERT_ALWAYS(param && param->name);
+    ASSERT_ALWAYS(param->length == 0);  // If fails here, note that the static registry doesn't support arrays
+    const int index = indexByName(param->name);
+    ASSERT_ALWAYS(index >= 0);          // If fails here, the param is missing from the static registry
+    ASSERT_ALWAYS(kindOf(descr(index)) == kindOf(param));
+    ASSERT_ALWAYS(domainOf(index) == param->domain);
+    return index;
+}
+#else
+static int indexOfName(const char* name, std::size_t length)
+{
+    unsigned comparisons = 0;
+    for (int i = 0; i < _num_params; i += numElements(i))
+    {
+        comparisons++;
+        if (compareName(i, name, length) == 0)
+        {
+            countLookup(i, comparisons);
+            return i;
+        }
+    }
+    countLookup(-1, comparisons);
+    return -1;
+}
+
+static int indexByName(const char* name);
+
+/**
+ * Appends the name like "name[3]" to the pool of the element names; returns its offset.
+ */
+static std::size_t addElementName(const char* name, int element)
+{
+    int num_digits = 1;
+    for (int x = element; x >= 10; x /= 10)
+    {
+        num_digits++;
+    }
+
+    const std::size_t name_length = std::strlen(name);
+    const std::size_t length = name_length + std::size_t(num_digits) + 2U;
+    ASSERT_ALWAYS(length <= CONFIG_PARAM_MAX_NAME_LENGTH);
+    // If fails here, increase CONFIG_ELEMENT_NAME_POOL_SIZE
+    ASSERT_ALWAYS((_element_names_used + length) < CONFIG_ELEMENT_NAME_POOL_SIZE);
+
+    const std::size_t offset = _element_names_used;
+    char* const out = &_element_names[offset];
+    std::memcpy(out, name, name_length);
+    out[name_length] = '[';
+    for (int i = num_digits, x = element; i > 0; i--, x /= 10)
+    {
+        out[name_length + std::size_t(i)] = char('0' + (x % 10));
+    }
+    out[length - 1U] = ']';
+    out[length] = '\0';
+    _element_names_used += length + 1U;
+    return offset;
+}
+
+static int registerParamImpl(const ConfigParam* param)
+{
+    // This function can not be executed after the startup initialization is finished
+    assert(!_frozen);
+    if (_frozen)
+    {
+        return -1;
+    }
+
+    ASSERT_ALWAYS(param && param->name);
+    const int num_elements = std::max(1, int(param->length));
+    ASSERT_ALWAYS((_num_params + num_elements) <= CONFIG_PARAMS_MAX);  // If fails here, increase CONFIG_PARAMS_MAX
+    ASSERT_ALWAYS(std::strlen(param->name) <= CONFIG_PARAM_MAX_NAME_LENGTH);
+    ASSERT_ALWAYS(std::strchr(param->name, '[') == NULL);  // Reserved for the element numbers of arrays
+    ASSERT_ALWAYS(param->domain < CONFIG_DOMAINS_MAX);  // If fails here, increase CONFIG_DOMAINS_MAX
+    ASSERT_ALWAYS(isValid(param, param->default_)); // If fails here, param descriptor is invalid
+    ASSERT_ALWAYS(indexByName(param->name) < 0);   // If fails here, param name is not unique
+
+    // Register this param; the elements of an array share the descriptor, but each of them has its own name
+    const int index = _num_params;
+    for (int i = index; i < (index + num_elements); i++)
+    {
+        ASSERT_ALWAYS(_descr_pool[i] == NULL);
+        _descr_pool[i] = param;
+        if (param->length > 0)
+        {
+            _element_name_offsets[i] = ElementNameOffset(addElementName(param->name, i - index));
+        }
+    }
+    _num_params += num_elements;
+
+    // Update the layout identification hash of the domain
+    for (const char* c = param->name; *c; c++)
+    {
+        _layout_hashes[param->domain] = _internal::crc32Step(_layout_hashes[param->domain], *c);
+    }
+
+    return index;
+}
+#endif
+
+/**
+ * The name may be followed by the element number of an array param, like "name[3]".
+ */
+static int indexByName(const char* name)
+{
+    assert(name);
+    if (!name)
+    {
+        return -1;
+    }
+
+    const char* const subscript = std::strchr(name, '[');
+    if (subscript == nullptr)
+    {
+        return indexOfName(name, std::strlen(name));
+    }
+
+    char* end = nullptr;
+    const long element = std::strtol(subscript + 1, &end, 10);
+    const int index = indexOfName(name, std::size_t(subscript - name));
+    if ((index < 0) || !std::isdigit(static_cast<unsigned char>(subscript[1])) || (std::strcmp(end, "]") != 0) ||
+        (descr(index)->length == 0) || (element >= numElements(index)))
+    {
+        return -1;
+    }
+    return index + int(element);
+}
+
+void configRegisterParam_(const ConfigParam* param)
+{
+    (void)registerParamImpl(param);
+}
+
+static void reinitializeDefaults(const std::bitset<CONFIG_PARAMS_MAX>& params)
+{
+    WriteSequenceLocker seq_locker;
+    for (int i = 0; i < numParams(); i++)
+    {
+        if (params[i])
+        {
+            storeRaw(i, defaultRaw(i));
+        }
+    }
+}
+
+/**
+ * The predicate tells whether the param at the specified index was changed. The caller must hold the mutex.
+ */
+template <typename Predicate>
+static void notifySubscribers(Predicate is_changed)
+{
+    for (auto sub = _subscriptions; sub != nullptr; sub = sub->next)
+    {
+        ::eventflags_t changed = 0;
+        for (unsigned i = 0; i < sub->num_params; i++)
+        {
+            if (is_changed(int(sub->indexes[i])))
+            {
+                changed |= ::eventflags_t(1) << i;
+            }
+        }
+
+        if (changed != 0)
+        {
+            chEvtBroadcastFlags(&sub->event_source, changed);
+            if (sub->callback)
+            {
+                sub->callback(changed);
+            }
+        }
+    }
+}
+
+static void markDirty(int index)
+{
+    if (!_dirty[index])
+    {
+        _dirty[index] = true;
+        _num_dirty += 1;
+    }
+}
+
+/**
+ * Makes the next save rewrite the domain even if none of its params are modified by then.
+ */
+static void markDomainDirty(const DomainState& dom)
+{
+    for (int i = 0; i < numParams(); i++)
+    {
+        if (dom.params[i])
+        {
+            markDirty(i);
+        }
+    }
+}
+
+static void clearDirty(const std::bitset<CONFIG_PARAMS_MAX>& params)
+{
+    _num_dirty -= unsigned((_dirty & params).count());
+    _dirty &= ~params;
+}
+
+static std::uint32_t computeImageCRC(const PoolRange& range, const void* values, const void* bits)
+{
+    return crc32(bits, int(range.bits_size), crc32(values, int(range.values_size)));
+}
+
+#if CONFIG_SPARSE_OVERRIDES_MAX == 0
+static std::uint8_t* getValuePoolAt(std::size_t offset)
+{
+    return reinterpret_cast<std::uint8_t*>(_value_pool) + offset;
+}
+
+static std::uint8_t* getBitPoolAt(std::size_t offset)
+{
+    return reinterpret_cast<std::uint8_t*>(_bit_pool) + offset;
+}
+#endif
+
+#if !CONFIG_STORAGE_JOURNAL
+static int saveImage(DomainState& dom)
+{
+    const unsigned num_dirty = unsigned((_dirty & dom.params).count());
+    if (num_dirty == 0)
+    {
+        return 0;
+    }
+
+    IStorageBackend* const storage = dom.storage;
+    const std::uint8_t* const values = getValuePoolAt(dom.range.values_offset);
+    const std::uint8_t* const bits = getBitPoolAt(dom.range.bits_offset);
+
+    int flash_res = 0;
+    for (int attempt = 0; attempt < MaxRetries; attempt++)
+    {
+        DEBUG_LOG("Save attempt %d, domain %s\n", attempt, dom.name);
+
+        // Erase
+        flash_res = eraseStorage(storage);
+        if (flash_res)
+        {
+            DEBUG_LOG("Erase error %d\n", flash_res);
+            continue;
+        }
+
+        // Write Layout
+        flash_res = writeStorage(storage, OFFSET_LAYOUT_HASH, &dom.format_hash, 4);
+        if (flash_res)
+        {
+            DEBUG_LOG("Hash write error %d\n", flash_res);
+            continue;
+        }
+
+        {
+            // Write CRC
+            const std::uint32_t true_crc = computeImageCRC(dom.range, values, bits);
+            flash_res = writeStorage(storage, OFFSET_CRC, &true_crc, 4);
+            if (flash_res)
+            {
+                DEBUG_LOG("CRC write error %d\n", flash_res);
+                continue;
+            }
+
+            // Write Values
+            flash_res = writeStorage(storage, OFFSET_VALUES, values, dom.range.values_size);
+            if (flash_res == 0)
+            {
+                flash_res = writeStorage(storage, OFFSET_VALUES + dom.range.values_size, bits, dom.range.bits_size);
+            }
+            if (flash_res)
+            {
+                DEBUG_LOG("Data write error %d\n", flash_res);
+                continue;
+            }
+        }
+
+        flash_res = storage->commit();
+        if (flash_res)
+        {
+            DEBUG_LOG("Commit error %d\n", flash_res);
+            continue;
+        }
+
+        DEBUG_LOG("Saved successfully\n");
+        clearDirty(dom.params);
+        return int(num_dirty);
+    }
+
+    assert(flash_res);
+    return flash_res;
+}
+
+#endif
+
+#if CONFIG_STORAGE_JOURNAL
+static std::size_t getJournalRecordSize(int index)
+{
+    return JournalRecord::HeaderSize + ((getValueSize(_kinds[index]) > 4) ? 8U : 4U);
+}
+
+/**
+ * Reads directly from the mapping if the storage is memory-mapped, which is much faster for small chunks.
+ */
+static int readStorage(IStorageBackend* storage, const void* mapping, std::size_t offset, void* data, std::size_t len)
+{
+    if (mapping != nullptr)
+    {
+        std::memcpy(data, static_cast<const std::uint8_t*>(mapping) + offset, len);
+        return 0;
+    }
+    return storage->read(offset, data, len);
+}
+
+/**
+ * See DomainState. This is slow, it is used only when the journal is appended.
+ */
+static int localIndexOf(int index)
+{
+    int out = 0;
+    for (int i = 0; i < index; i++)
+    {
+        out += (domainOf(i) == domainOf(index)) ? 1 : 0;
+    }
+    return out;
+}
+
+/**
+ * Fills the table that maps the local indexes of the params of the domain onto their indexes; returns the number
+ * of params in the domain.
+ */
+static int mapLocalIndexes(const DomainState& dom, std::uint16_t (&out_indexes)[CONFIG_PARAMS_MAX])
+{
+    int num_local = 0;
+    for (int i = 0; i < numParams(); i++)
+    {
+        if (dom.params[i])
+        {
+            out_indexes[num_local++] = std::uint16_t(i);
+        }
+    }
+    return num_local;
+}
+
+/**
+ * Invokes the handler for every record in the journal of the domain in the order of their appearance.
+ * Returns the offset where the next record can be appended, or zero if the storage could not be read.
+ * The journal is never appended after a damaged record, so the damaged record, if any, terminates the journal.
+ */
+template <typename Handler>
+static std::size_t replayJournal(const DomainState& dom, Handler handler, bool& out_damaged)
+{
+    std::uint16_t indexes[CONFIG_PARAMS_MAX];
+    const int num_local = mapLocalIndexes(dom, indexes);
+
+    out_damaged = false;
+    const std::size_t capacity = dom.storage->getSize();
+    const void* const mapping = dom.storage->map(0, capacity);
+    std::size_t offset = OFFSET_JOURNAL_RECORDS;
+    while ((offset + JournalRecord::HeaderSize) <= capacity)
+    {
+        JournalRecord rec{};
+        if (readStorage(dom.storage, mapping, offset, &rec, JournalRecord::HeaderSize))
+        {
+            return 0;
+        }
+        if (rec.isErased())
+        {
+            break;
+        }
+
+        const std::size_t size = (rec.index < num_local) ? getJournalRecordSize(indexes[rec.index]) : 0;
+        if ((size == 0) || ((offset + size) > capacity))
+        {
+            out_damaged = true;
+            break;
+        }
+
+        const std::size_t value_size = size - JournalRecord::HeaderSize;
+        if (readStorage(dom.storage, mapping, offset + JournalRecord::HeaderSize, rec.value, value_size))
+        {
+            return 0;
+        }
+        if (rec.check != rec.computeCheck(value_size))
+        {
+            out_damaged = true;
+            break;
+        }
+
+        handler(int(indexes[rec.index]), rec.value[0] | (std::uint64_t(rec.value[1]) << 32U));
+        offset += size;
+    }
+    return offset;
+}
+
+static int appendJournalRecord(DomainState& dom, int index)
+{
+    const std::uint64_t raw = loadRaw(index);
+    JournalRecord rec{};
+    rec.index = std::uint16_t(localIndexOf(index));
+    rec.value[0] = std::uint32_t(raw);
+    rec.value[1] = std::uint32_t(raw >> 32U);
+
+    const std::size_t size = getJournalRecordSize(index);
+    rec.check = rec.computeCheck(size - JournalRecord::HeaderSize);
+
+    const int res = writeStorage(dom.storage, dom.journal_end, &rec, size);
+    if (res)
+    {
+        dom.journal_end = 0;            // The journal may be damaged now, it has to be compacted
+        return res;
+    }
+    dom.journal_end += size;
+    return 0;
+}
+
+/**
+ * Rewrites the journal from scratch; only the params that differ from their default values are written.
+ */
+static int compactJournal(DomainState& dom)
+{
+    DEBUG_LOG("Compacting the journal\n");
+    dom.journal_end = 0;
+
+    int flash_res = eraseStorage(dom.storage);
+    if (flash_res)
+    {
+        DEBUG_LOG("Erase error %d\n", flash_res);
+        return flash_res;
+    }
+
+    flash_res = writeStorage(dom.storage, OFFSET_LAYOUT_HASH, &dom.format_hash, 4);
+    if (flash_res)
+    {
+        DEBUG_LOG("Hash write error %d\n", flash_res);
+        return flash_res;
+    }
+
+    flash_res = writeStorage(dom.storage, OFFSET_JOURNAL_MAGIC, &JournalMagic, 4);
+    if (flash_res)
+    {
+        DEBUG_LOG("Magic write error %d\n", flash_res);
+        return flash_res;
+    }
+
+    dom.journal_end = OFFSET_JOURNAL_RECORDS;
+
+    for (int i = 0; i < numParams(); i++)
+    {
+        if (dom.params[i] && (loadRaw(i) != defaultRaw(i)))
+        {
+            flash_res = appendJournalRecord(dom, i);
+            if (flash_res)
+            {
+                DEBUG_LOG("Record write error %d\n", flash_res);
+                return flash_res;
+            }
+        }
+    }
+
+    return 0;
+}
+
+static int saveJournal(DomainState& dom)
+{
+    const unsigned num_dirty = unsigned((_dirty & dom.params).count());
+    if (num_dirty == 0)
+    {
+        return 0;
+    }
+
+    int flash_res = 0;
+    for (int attempt = 0; attempt < MaxRetries; attempt++)
+    {
+        DEBUG_LOG("Save attempt %d, domain %s, %u records\n", attempt, dom.name, num_dirty);
+
+        if ((dom.journal_end == 0) ||
+            ((dom.journal_end + num_dirty * sizeof(JournalRecord)) > dom.storage->getSize()))
+        {
+#if CONFIG_SPARSE_OVERRIDES_MAX > 0
+            if (dom.incomplete)
+            {
+                DEBUG_LOG("Not compacting, the values that were dropped on restore would be lost\n");
+                return -ENOSPC;
+            }
+#endif
+            flash_res = compactJournal(dom);    // Writes all non-default values, so we're done here
+        }
+        else
+        {
+            for (int i = 0; (i < numParams()) && (flash_res == 0); i++)
+            {
+                if (_dirty[i] && dom.params[i])
+                {
+                    flash_res = appendJournalRecord(dom, i);
+                }
+            }
+        }
+
+        if (flash_res == 0)
+        {
+            flash_res = dom.storage->commit();
+        }
+
+        if (flash_res == 0)
+        {
+            DEBUG_LOG("Saved successfully\n");
+            clearDirty(dom.params);
+            return int(num_dirty);
+        }
+    }
+
+    assert(flash_res);
+    return flash_res;
+}
+#endif
+
+/**
+ * The caller must hold the mutex and the storage mutex.
+ */
+static int saveDomainLocked(DomainState& dom)
+{
+#if CONFIG_STORAGE_JOURNAL
+    return saveJournal(dom);
+#else
+    return saveImage(dom);
+#endif
+}
+
+/**
+ * Saves the domains that contain modified params. The caller must hold the mutex.
+ */
+static int saveLocked()
+{
+    os::MutexLocker storage_locker(_storage_mutex);
+    if (_num_dirty == 0)
+    {
+        DEBUG_LOG("Nothing to save\n");
+        return 0;
+    }
+#if CONFIG_INSTRUMENTATION
+    const ::systime_t started_at = chVTGetSystemTimeX();
+#endif
+
+    int num_saved = 0;
+    int error = 0;
+    for (DomainState& dom : _domains)
+    {
+        const int res = (dom.storage != nullptr) ? saveDomainLocked(dom) : 0;
+        if (res < 0)
+        {
+            error = (error < 0) ? error : res;
+        }
+        else
+        {
+            num_saved += res;
+        }
+    }
+#if CONFIG_INSTRUMENTATION
+    _access_stats.saves++;
+    const std::uint32_t duration = accumulateDuration(_access_stats.save_duration_total, started_at);
+    _access_stats.save_duration_max = std::max(_access_stats.save_duration_max, duration);
+#endif
+    return (error < 0) ? error : num_saved;
+}
+
+int configSave(void)
+{
+    ASSERT_ALWAYS(_frozen);
+    ConfigMutexLocker locker(_mutex);
+    return saveLocked();
+}
+
+/**
+ * Erases the storage of the domains and resets their params to the defaults; the params of the domains that
+ * failed to erase are not reset. The caller must hold the mutex.
+ */
+static int eraseLocked(const std::bitset<CONFIG_DOMAINS_MAX>& domains)
+{
+    os::MutexLocker storage_locker(_storage_mutex);
+
+    int res = 0;
+    std::bitset<CONFIG_PARAMS_MAX> params;
+    for (int d = 0; d < CONFIG_DOMAINS_MAX; d++)
+    {
+        DomainState& dom = _domains[d];
+        if (!domains[d] || (dom.storage == nullptr))
+        {
+            continue;
+        }
+
+        int dom_res = eraseStorage(dom.storage);
+        if (dom_res >= 0)
+        {
+            dom_res = dom.storage->commit();
+        }
+#if CONFIG_STORAGE_JOURNAL
+        dom.journal_end = 0;
+#endif
+        if (dom_res >= 0)
+        {
+#if CONFIG_SPARSE_OVERRIDES_MAX > 0
+            dom.incomplete = false;
+#endif
+            params |= dom.params;
+        }
+        else
+        {
+            res = (res < 0) ? res : dom_res;
+        }
+    }
+
+    if (params.any())
+    {
+        std::bitset<CONFIG_PARAMS_MAX> changed;
+        for (int i = 0; i < numParams(); i++)
+        {
+            changed[i] = params[i] && _subscribed[i] && (loadRaw(i) != defaultRaw(i));
+        }
+
+        reinitializeDefaults(params);
+        clearDirty(params);             // The defaults need not be saved
+        _modification_cnt += 1;
+
+        if (changed.any())
+        {
+            notifySubscribers([&changed](int index) { return changed[index]; });
+        }
+    }
+    return res;
+}
+
+int configErase(void)
+{
+    ASSERT_ALWAYS(_frozen);
+    ConfigMutexLocker locker(_mutex);
+    return eraseLocked(std::bitset<CONFIG_DOMAINS_MAX>().set());
+}
+
+const char* configNameByIndex(int index)
+{
+    ASSERT_ALWAYS(_frozen);
+    assert(index >= 0);
+    if (index < 0 || index >= numParams())
+    {
+        return NULL;
+    }
+#if !CONFIG_STATIC_REGISTRY
+    if (descr(index)->length > 0)
+    {
+        return &_element_names[_element_name_offsets[index]];
+    }
+#endif
+    return descr(index)->name;
+}
+
+/**
+ * The value must be validated by the caller.
+ */
+static int setByIndex(int index, std::uint64_t raw)
+{
+    countSet(index);
+    if (loadRaw(index) != raw)
+    {
+        if (getOverrideDelta(index, raw) > getFreeOverrides())
+        {
+            return -ENOSPC;
+        }
+        {
+            WriteSequenceLocker seq_locker;
+            storeRaw(index, raw);
+        }
+        markDirty(index);
+        if (_subscribed[index])
+        {
+            notifySubscribers([index](int i) { return i == index; });
+        }
+    }
+    _modification_cnt += 1;
+    return 0;
+}
+
+/**
+ * Assigns the values of multiple params at once; raw_of(index) returns the validated value of the param.
+ * The caller must hold the mutex.
+ */
+template <typename RawOf>
+static int setMultipleByIndex(const std::bitset<CONFIG_PARAMS_MAX>& params, RawOf raw_of)
+{
+    std::bitset<CONFIG_PARAMS_MAX> changed;
+    std::bitset<CONFIG_PARAMS_MAX> growing;
+    int override_delta = 0;
+    for (int i = 0; i < numParams(); i++)
+    {
+        if (params[i])
+        {
+            countSet(i);
+            const std::uint64_t raw = raw_of(i);
+            changed[i] = loadRaw(i) != raw;
+            const int delta = getOverrideDelta(i, raw);
+            growing[i] = delta > 0;
+            override_delta += delta;
+        }
+    }
+    if (override_delta > getFreeOverrides())
+    {
+        return -ENOSPC;
+    }
+
+    if (changed.any())
+    {
+        // The overrides that are released go first to make room for the new ones
+        {
+            WriteSequenceLocker seq_locker;
+            for (const auto& pending : { changed & ~growing, changed & growing })
+            {
+                for (int i = 0; i < numParams(); i++)
+                {
+                    if (pending[i])
+                    {
+                        storeRaw(i, raw_of(i));
+                    }
+                }
+            }
+        }
+
+        for (int i = 0; i < numParams(); i++)
+        {
+            if (changed[i])
+            {
+                markDirty(i);
+            }
+        }
+
+        if ((changed & _subscribed).any())
+        {
+            notifySubscribers([&changed](int index) { return changed[index]; });
+        }
+    }
+    _modification_cnt += 1;
+    return 0;
+}
+
+int configSet(const char* name, float value)
+{
+    ASSERT_ALWAYS(_frozen);
+    ConfigMutexLocker locker(_mutex);
+
+    const int index = indexByName(name);
+    if (index < 0)
+    {
+        return -ENOENT;
+    }
+
+    std::uint64_t raw = 0;
+    if (!makeRaw(index, value, raw))
+    {
+        return -EINVAL;
+    }
+
+    return setByIndex(index, raw);
+}
+
+int configGetDescr(const char* name, ConfigParam* out)
+{
+    ASSERT_ALWAYS(_frozen);
+    assert(out);
+    if (!out)
+    {
+        return -EINVAL;
+    }
+
+    // Locking is not required here, the descriptors are immutable
+    const int index = indexByName(name);
+    if (index < 0)
+    {
+        return -ENOENT;
+    }
+
+    *out = *descr(index);
+    return 0;
+}
+
+float configGet(const char* name)
+{
+    ASSERT_ALWAYS(_frozen);
+    const int index = indexByName(name);
+    assert(index >= 0);
+    if (index >= 0)
+    {
+        countGet(index);
+    }
+    const float val = (index < 0) ? nanf("") : float(rawToDouble(_kinds[index], loadRaw(index)));
+    assert(std::isfinite(val));
+    return val;
+}
+
+static void restoreLegacy(int index, float value)
+{
+    std::uint64_t raw = 0;
+    if (makeRaw(index, value, raw))
+    {
+        storeRaw(index, raw);
+    }
+}
+
+/**
+ * Fetches the raw value of the param from an image of the specified range of the value pools.
+ */
+static std::uint64_t extractRaw(const PoolRange& range, const std::uint8_t* values, const std::uint8_t* bits,
+                                int index)
+{
+    const unsigned slot = _slots[index];
+    const Kind kind = _kinds[index];
+    if (kind == Kind::Bit)
+    {
+        const unsigned bit = slot - unsigned(range.bits_offset * 8U);
+        return (bits[bit / 8U] >> (bit % 8U)) & 1U;
+    }
+
+    std::uint64_t raw = 0;                  // Little endian
+    std::memcpy(&raw, values + (slot - range.values_offset), getValueSize(kind));
+    return raw;
+}
+
+#if CONFIG_SPARSE_OVERRIDES_MAX > 0
+/**
+ * The reverse of extractRaw(); the bit pool image must be zeroed beforehand.
+ */
+static void insertRaw(const PoolRange& range, std::uint8_t* values, std::uint8_t* bits, int index, std::uint64_t raw)
+{
+    const unsigned slot = _slots[index];
+    const Kind kind = _kinds[index];
+    if (kind == Kind::Bit)
+    {
+        const unsigned bit = slot - unsigned(range.bits_offset * 8U);
+        bits[bit / 8U] = std::uint8_t(bits[bit / 8U] | ((raw & 1U) << (bit % 8U)));
+        return;
+    }
+
+    std::memcpy(values + (slot - range.values_offset), &raw, getValueSize(kind));
+}
+#endif
+
+/**
+ * The image is validated in place, and only the values that pass are copied.
+ */
+static int restoreMappedImage(const DomainState& dom, const std::uint8_t* mapping)
+{
+    const std::uint8_t* const values = mapping + OFFSET_VALUES;
+    const std::uint8_t* const bits = values + dom.range.values_size;
+
+    std::uint32_t stored_crc = 0;
+    std::memcpy(&stored_crc, mapping + OFFSET_CRC, 4);
+    if (computeImageCRC(dom.range, values, bits) != stored_crc)
+    {
+        return InitCodeCRCMismatch;         // The defaults are already in place
+    }
+
+    for (int i = 0; i < numParams(); i++)
+    {
+        if (dom.params[i])
+        {
+            const std::uint64_t raw = extractRaw(dom.range, values, bits, i);
+            if (isValidRaw(i, raw))
+            {
+                storeRaw(i, raw);
+            }
+        }
+    }
+
+    return InitCodeRestored;
+}
+
+static int restoreImage(const DomainState& dom)
+{
+    IStorageBackend* const storage = dom.storage;
+    const void* const mapping = storage->map(0, OFFSET_VALUES + dom.range.values_size + dom.range.bits_size);
+    if (mapping != nullptr)
+    {
+        return restoreMappedImage(dom, static_cast<const std::uint8_t*>(mapping));
+    }
+
+#if CONFIG_SPARSE_OVERRIDES_MAX > 0
+    // There are no pools to read the image into, so the CRC is computed in chunks, then the values are read one by one
+    const std::size_t image_size = dom.range.values_size + dom.range.bits_size;
+    for (int attempt = 0; attempt < MaxRetries; attempt++)
+    {
+        std::uint32_t true_crc = 0;
+        int flash_res = 0;
+        for (std::size_t offset = 0; (offset < image_size) && (flash_res == 0);)
+        {
+            std::uint8_t chunk[32];
+            const std::size_t len = std::min(sizeof(chunk), image_size - offset);
+            flash_res = storage->read(OFFSET_VALUES + offset, chunk, len);
+            true_crc = crc32(chunk, int(len), true_crc);
+            offset += len;
+        }
+        std::uint32_t stored_crc = 0;
+        if (flash_res || storage->read(OFFSET_CRC, &stored_crc, 4) || (true_crc != stored_crc))
+        {
+            continue;
+        }
+
+        // Invalid values are left at defaults
+        for (int i = 0; (i < numParams()) && (flash_res == 0); i++)
+        {
+            if (dom.params[i])
+            {
+                const unsigned slot = _slots[i];
+                std::uint64_t raw = 0;          // Little endian
+                if (_kinds[i] == Kind::Bit)
+                {
+                    const std::size_t byte = dom.range.values_size + slot / 8U - dom.range.bits_offset;
+                    flash_res = storage->read(OFFSET_VALUES + byte, &raw, 1);
+                    raw = (raw >> (slot % 8U)) & 1U;
+                }
+                else
+                {
+                    flash_res = storage->read(OFFSET_VALUES + slot - dom.range.values_offset, &raw,
+                                              getValueSize(_kinds[i]));
+                }
+                if ((flash_res == 0) && isValidRaw(i, raw))
+                {
+                    storeRaw(i, raw);
+                }
+            }
+        }
+        if (flash_res == 0)
+        {
+            return InitCodeRestored;
+        }
+    }
+#else
+    std::uint8_t* const values = getValuePoolAt(dom.range.values_offset);
+    std::uint8_t* const bits = getBitPoolAt(dom.range.bits_offset);
+    for (int attempt = 0; attempt < MaxRetries; attempt++)
+    {
+        // Read the data
+        int flash_res = storage->read(OFFSET_VALUES, values, dom.range.values_size);
+        if (flash_res == 0)
+        {
+            flash_res = storage->read(OFFSET_VALUES + dom.range.values_size, bits, dom.range.bits_size);
+        }
+        if (flash_res)
+        {
+            continue;
+        }
+
+        // Check CRC
+        const std::uint32_t true_crc = computeImageCRC(dom.range, values, bits);
+        std::uint32_t stored_crc = 0;
+        flash_res = storage->read(OFFSET_CRC, &stored_crc, 4);
+        if (flash_res || (true_crc != stored_crc))
+        {
+            continue;
+        }
+
+        // Reinitialize defaults if restored values are not valid
+        for (int i = 0; i < numParams(); i++)
+        {
+            if (dom.params[i] && !isValidRaw(i, loadRaw(i)))
+            {
+                storeRaw(i, defaultRaw(i));
+            }
+        }
+
+        return InitCodeRestored;
+    }
+#endif
+
+    reinitializeDefaults(dom.params);
+
+    return InitCodeCRCMismatch;
+}
+
+/**
+ * The image of the format version 1 is converted; it will be rewritten in the current format on the next save.
+ */
+static int restoreLegacyImage(const DomainState& dom)
+{
+    IStorageBackend* const storage = dom.storage;
+    for (int attempt = 0; attempt < MaxRetries; attempt++)
+    {
+        // Check CRC
+        std::uint32_t true_crc = 0;
+        int flash_res = 0;
+        std::size_t offset = OFFSET_VALUES;
+        for (int i = 0; (i < numParams()) && (flash_res == 0); i++)
+        {
+            if (dom.params[i])
+            {
+                float value = 0;
+                flash_res = storage->read(offset, &value, sizeof(value));
+                true_crc = crc32(&value, sizeof(value), true_crc);
+                offset += sizeof(value);
+            }
+        }
+        std::uint32_t stored_crc = 0;
+        if (flash_res || storage->read(OFFSET_CRC, &stored_crc, 4) || (true_crc != stored_crc))
+        {
+            continue;
+        }
+
+        // Invalid values are left at defaults
+        offset = OFFSET_VALUES;
+        for (int i = 0; i < numParams(); i++)
+        {
+            if (dom.params[i])
+            {
+                float value = 0;
+                if (storage->read(offset, &value, sizeof(value)) == 0)
+                {
+                    restoreLegacy(i, value);
+                }
+                offset += sizeof(value);
+            }
+        }
+
+        return InitCodeRestored;
+    }
+
+    reinitializeDefaults(dom.params);
+
+    return InitCodeCRCMismatch;
+}
+
+#if CONFIG_STORAGE_JOURNAL
+static void restoreRaw(int index, std::uint64_t raw)
+{
+    if (isValidRaw(index, raw))
+    {
+        storeRaw(index, raw);
+    }
+}
+
+static int restoreJournal(DomainState& dom)
+{
+    std::uint32_t magic = 0;
+    for (int attempt = 0; attempt < MaxRetries; attempt++)
+    {
+        if ((dom.storage->read(OFFSET_JOURNAL_MAGIC, &magic, 4) == 0) && (magic == JournalMagic))
+        {
+            break;
+        }
+    }
+
+    if (magic != JournalMagic)
+    {
+        // The storage may contain a valid full image, it will be converted into a journal on the next save
+        return restoreImage(dom);
+    }
+
+    for (int attempt = 0; attempt < MaxRetries; attempt++)
+    {
+        bool damaged = false;
+        dom.journal_end = replayJournal(dom, restoreRaw, damaged);
+        if (dom.journal_end > 0)
+        {
+            if (damaged)
+            {
+                dom.journal_end = 0;    // Will be rewritten from scratch on the next save
+            }
+            return InitCodeRestored;
+        }
+        reinitializeDefaults(dom.params);
+    }
+
+    return InitCodeCRCMismatch;
+}
+#endif
+
+namespace os
+{
+namespace config
+{
+namespace _internal
+{
+
+int registerParam(const ::ConfigParam* param)
+{
+    const int index = registerParamImpl(param);
+    ASSERT_ALWAYS(index >= 0);
+#if !CONFIG_STATIC_REGISTRY
+    _typed_params[index] = param->length == 0;      // Arrays are not Param<> instances
+#endif
+    return index;
+}
+
+template <typename T>
+T getValueByIndex(int index)
+{
+    ASSERT_ALWAYS(_frozen);
+    assert((index >= 0) && (index < numParams()));
+    countGet(index);
+    const Kind kind = _kinds[index];
+    const std::uint64_t raw = loadRaw(index);
+    if (kind == kindOf<T>())
+    {
+        return fromRaw<T>(raw);
+    }
+    return visitNativeType(kind, [raw](auto tag) { return static_cast<T>(fromRaw<decltype(tag)>(raw)); });
+}
+
+template <typename T>
+int stageValue(int index, T value, StagedValue& out)
+{
+    ASSERT_ALWAYS(_frozen);
+    assert((index >= 0) && (index < numParams()));
+
+    out.index = std::uint16_t(index);
+    if (_kinds[index] == kindOf<T>())
+    {
+        if (!isWithinLimits(index, value))
+        {
+            return -EINVAL;
+        }
+        out.raw = toRaw(value);
+    }
+    else if (!makeRaw(index, double(value), out.raw))
+    {
+        return -EINVAL;
+    }
+    return 0;
+}
+
+int stageValue(const char* name, float value, StagedValue& out)
+{
+    ASSERT_ALWAYS(_frozen);
+    const int index = indexByName(name);
+    if (index < 0)
+    {
+        return -ENOENT;
+    }
+
+    out.index = std::uint16_t(index);
+    if (!makeRaw(index, value, out.raw))
+    {
+        return -EINVAL;
+    }
+    return 0;
+}
+
+int commitStagedValues(const StagedValue* values, std::size_t num_values, bool save)
+{
+    ASSERT_ALWAYS(_frozen);
+    assert((values != nullptr) || (num_values == 0));
+    ConfigMutexLocker locker(_mutex);
+
+    // The latest value of a param wins, the earlier ones are ignored
+    std::bitset<CONFIG_PARAMS_MAX> staged;
+    std::uint16_t latest[CONFIG_PARAMS_MAX];
+    for (std::size_t i = 0; i < num_values; i++)
+    {
+        const int index = values[i].index;
+        assert(index < numParams());
+        staged[index] = true;
+        latest[index] = std::uint16_t(i);
+    }
+
+    const int res = setMultipleByIndex(staged, [values, &latest](int index) { return values[latest[index]].raw; });
+    if (res < 0)
+    {
+        return res;
+    }
+    return save ? saveLocked() : 0;
+}
+
+template <typename T>
+int setValueByIndex(int index, T value)
+{
+    StagedValue staged{};
+    const int res = stageValue(index, value, staged);
+    if (res < 0)
+    {
+        return res;
+    }
+
+    ConfigMutexLocker locker(_mutex);
+    return setByIndex(index, staged.raw);
+}
+
+template <typename T>
+int setValuesByIndex(int index, const T* values, std::size_t count)
+{
+    ASSERT_ALWAYS(_frozen);
+    assert((index >= 0) && ((index + int(count)) <= numParams()));
+
+    // All values are validated before anything is modified; they are converted again when assigned
+    std::bitset<CONFIG_PARAMS_MAX> params;
+    for (std::size_t i = 0; i < count; i++)
+    {
+        StagedValue staged{};
+        const int res = stageValue(index + int(i), values[i], staged);
+        if (res < 0)
+        {
+            return res;
+        }
+        params[index + int(i)] = true;
+    }
+
+    const auto raw_of = [index, values](int i)
+        {
+            StagedValue staged{};
+            (void)stageValue(i, values[i - index], staged);
+            return staged.raw;
+        };
+
+    ConfigMutexLocker locker(_mutex);
+    return setMultipleByIndex(params, raw_of);
+}
+
+#define CONFIG_INSTANTIATE_FOR_NATIVE_TYPE_(T)                      \
+    template T getValueByIndex<T>(int);                             \
+    template int setValueByIndex<T>(int, T);                        \
+    template int setValuesByIndex<T>(int, const T*, std::size_t);   \
+    template int stageValue<T>(int, T, StagedValue&);
+
+CONFIG_INSTANTIATE_FOR_NATIVE_TYPE_(bool)
+CONFIG_INSTANTIATE_FOR_NATIVE_TYPE_(float)
+CONFIG_INSTANTIATE_FOR_NATIVE_TYPE_(std::uint8_t)
+CONFIG_INSTANTIATE_FOR_NATIVE_TYPE_(std::int8_t)
+CONFIG_INSTANTIATE_FOR_NATIVE_TYPE_(std::uint16_t)
+CONFIG_INSTANTIATE_FOR_NATIVE_TYPE_(std::int16_t)
+CONFIG_INSTANTIATE_FOR_NATIVE_TYPE_(std::uint32_t)
+CONFIG_INSTANTIATE_FOR_NATIVE_TYPE_(std::int32_t)
+CONFIG_INSTANTIATE_FOR_NATIVE_TYPE_(std::uint64_t)
+CONFIG_INSTANTIATE_FOR_NATIVE_TYPE_(std::int64_t)
+
+#undef CONFIG_INSTANTIATE_FOR_NATIVE_TYPE_
+
+unsigned beginRead()
+{
+    unsigned seq = _write_seq.load(std::memory_order_acquire);
+    while ((seq & 1U) != 0)             // Can only happen when the writer runs on another core
+    {
+        seq = _write_seq.load(std::memory_order_acquire);
+    }
+    return seq;
+}
+
+bool endRead(unsigned seq)
+{
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return _write_seq.load(std::memory_order_relaxed) == seq;
+}
+
+}
+
+static int restoreDomain(DomainState& dom, int domain)
+{
+    const std::uint32_t layout_hash = layoutHash(domain);
+    std::uint32_t stored_layout_hash = 0xdeadbeef;
+
+    // Read the layout hash; no point retrying if it's memory-mapped
+    if (const void* const mapping = dom.storage->map(OFFSET_LAYOUT_HASH, 4))
+    {
+        std::memcpy(&stored_layout_hash, mapping, 4);
+    }
+    else
+    {
+        for (int attempt = 0; attempt < MaxRetries; attempt++)
+        {
+            int flash_res = dom.storage->read(OFFSET_LAYOUT_HASH, &stored_layout_hash, 4);
+            if (flash_res == 0)
+            {
+                if ((stored_layout_hash == dom.format_hash) || (stored_layout_hash == layout_hash))
+                {
+                    break;
+                }
+            }
+        }
+    }
+
+    if ((stored_layout_hash != dom.format_hash) && (stored_layout_hash != layout_hash))
+    {
+        return InitCodeLayoutMismatch;
+    }
+
+    // If the layout hash has not changed, we can restore the values safely
+    const bool legacy = stored_layout_hash != dom.format_hash;
+#if CONFIG_SPARSE_OVERRIDES_MAX > 0
+    const unsigned dropped_before = _num_dropped_overrides;
+#endif
+#if CONFIG_STORAGE_JOURNAL
+    const int res = legacy ? restoreLegacyImage(dom) : restoreJournal(dom);  // v1 had no journal
+    const bool outdated = dom.journal_end == 0;     // A legacy image, a damaged journal, or a full image
+#else
+    const int res = legacy ? restoreLegacyImage(dom) : restoreImage(dom);
+    const bool outdated = legacy;
+#endif
+#if CONFIG_SPARSE_OVERRIDES_MAX > 0
+    dom.incomplete = _num_dropped_overrides != dropped_before;
+    if (dom.incomplete)
+    {
+        return res;                 // Rewriting the domain would lose the dropped values, see saveJournal()
+    }
+#endif
+    if ((res == InitCodeRestored) && outdated)
+    {
+        markDomainDirty(dom);       // The save is a no-op otherwise, unless some of the params are modified
+    }
+    return res;
+}
+
+int attachStorage(const Domain& domain, IStorageBackend* storage)
+{
+    ASSERT_ALWAYS(!_frozen);
+    if (domain.index >= CONFIG_DOMAINS_MAX)
+    {
+        return -EINVAL;
+    }
+    _domains[domain.index].storage = storage;
+    _domains[domain.index].name = domain.name;
+    return 0;
+}
+
+int init(IStorageBackend* storage)
+{
+    ASSERT_ALWAYS(numParams() <= CONFIG_PARAMS_MAX);  // being paranoid
+    ASSERT_ALWAYS(!_frozen);
+
+    if (storage == nullptr)
+    {
+        return -EINVAL;
+    }
+
+    (void)attachStorage(DefaultDomain, storage);
+
+    for (int i = 0; i < numParams(); i++)
+    {
+        _domains[domainOf(i)].params[i] = true;
+    }
+
+    for (const DomainState& dom : _domains)
+    {
+        if (dom.params.any() && (dom.storage == nullptr))
+        {
+            return -EINVAL;
+        }
+#if CONFIG_STORAGE_JOURNAL
+        // The storage must be able to accommodate the header and at least one record per param
+        if ((dom.storage != nullptr) &&
+            (dom.storage->getSize() < (OFFSET_JOURNAL_RECORDS + sizeof(JournalRecord) * dom.params.count())))
+        {
+            return -EINVAL;
+        }
+#endif
+    }
 
-static int indexByName(const char* name)
-{
-    assert(name);
-    if (!name)
+    _frozen = true;
+
+    freezeValidationTable();
+    ASSERT_ALWAYS(assignSlots());       // If fails here, increase CONFIG_VALUE_POOL_SIZE
+
+    std::uint32_t snapshot_hash = 0;
+    for (int d = 0; d < CONFIG_DOMAINS_MAX; d++)
     {
-        return -1;
+        _domains[d].format_hash = computeFormatHash(d);
+        snapshot_hash = crc32(&_domains[d].format_hash, 4, snapshot_hash);
     }
-    for (int i = 0; i < _num_params; i++)
+    _snapshot_hash = snapshot_hash;
+
+    reinitializeDefaults(std::bitset<CONFIG_PARAMS_MAX>().set());      // Init defaults by default
+
+    int result = 0;
+    for (int d = 0; d < CONFIG_DOMAINS_MAX; d++)
     {
-        if (!std::strcmp(_descr_pool[i]->name, name))
+        if (_domains[d].storage != nullptr)
         {
-            return i;
+            const int res = restoreDomain(_domains[d], d);
+            DEBUG_LOG("Domain %s init %d\n", _domains[d].name, res);
+            result = (d == DefaultDomain.index) ? res : result;
         }
     }
-    return -1;
-}
-
-void configRegisterParam_(const ConfigParam* param)
-{
-    // This function can not be executed after the startup initialization is finished
-    assert(!_frozen);
-    if (_frozen)
+#if CONFIG_SPARSE_OVERRIDES_MAX > 0
+    if (_num_dropped_overrides > 0)
     {
-        return;
+        DEBUG_LOG("%u stored values did not fit the override table\n", _num_dropped_overrides);
+        result = -ENOSPC;
     }
+#endif
+#if CONFIG_INSTRUMENTATION
+    resetAccessStatistics();
+#endif
+    return result;
+}
 
-    ASSERT_ALWAYS(param && param->name);
-    ASSERT_ALWAYS(_num_params < CONFIG_PARAMS_MAX);  // If fails here, increase CONFIG_PARAMS_MAX
-    ASSERT_ALWAYS(isValid(param, param->default_)); // If fails here, param descriptor is invalid
-    ASSERT_ALWAYS(indexByName(param->name) < 0);   // If fails here, param name is not unique
+std::uint16_t getParamCount()
+{
+    return std::uint16_t(numParams());
+}
 
-    // Register this param
-    const int index = _num_params++;
-    ASSERT_ALWAYS(_descr_pool[index] == NULL);
-    _descr_pool[index] = param;
-    _value_pool[index] = param->default_;
+unsigned getModificationCounter()
+{
+    return _modification_cnt;           // Atomic access
+}
 
-    // Update the layout identification hash
-    for (const char* c = param->name; *c; c++)
-    {
-        _layout_hash = crc32_step(_layout_hash, *c);
-    }
+unsigned getUnsavedParamCount()
+{
+    return _num_dirty;                  // Atomic access
 }
 
-static void reinitializeDefaults()
+void subscribe(_internal::ChangeSubscriptionBase& subscription)
 {
-    for (int i = 0; i < _num_params; i++)
+    ASSERT_ALWAYS(_frozen);
+    ConfigMutexLocker locker(_mutex);
+
+    for (unsigned i = 0; i < subscription.num_params; i++)
     {
-        _value_pool[i] = _descr_pool[i]->default_;
+        const int index = indexByName(subscription.params[i]->name);
+        ASSERT_ALWAYS(index >= 0);
+        subscription.indexes[i] = std::uint16_t(index);
+        _subscribed[index] = true;
     }
+
+    subscription.next = _subscriptions;
+    _subscriptions = &subscription;
 }
 
-int configSave(void)
+void unsubscribe(_internal::ChangeSubscriptionBase& subscription)
 {
     ASSERT_ALWAYS(_frozen);
-    os::MutexLocker locker(_mutex);
+    ConfigMutexLocker locker(_mutex);
 
-    int flash_res = 0;
-    for (int attempt = 0; attempt < MaxRetries; attempt++)
+    _subscribed.reset();
+    for (auto* link = &_subscriptions; *link != nullptr;)
     {
-        DEBUG_LOG("Save attempt %d\n", attempt);
-
-        // Erase
-        flash_res = g_storage->erase();
-        if (flash_res)
+        if (*link == &subscription)
         {
-            DEBUG_LOG("Erase error %d\n", flash_res);
-            continue;
-        }
-
-        // Write Layout
-        flash_res = g_storage->write(OFFSET_LAYOUT_HASH, &_layout_hash, 4);
-        if (flash_res)
-        {
-            DEBUG_LOG("Hash write error %d\n", flash_res);
+            *link = subscription.next;
+            subscription.next = nullptr;
             continue;
         }
-
+        for (unsigned i = 0; i < (*link)->num_params; i++)
         {
-            // Write CRC
-            const int pool_len = _num_params * sizeof(_value_pool[0]);
-            const std::uint32_t true_crc = crc32(_value_pool, pool_len);
-            flash_res = g_storage->write(OFFSET_CRC, &true_crc, 4);
-            if (flash_res)
-            {
-                DEBUG_LOG("CRC write error %d\n", flash_res);
-                continue;
-            }
-
-            // Write Values
-            flash_res = g_storage->write(OFFSET_VALUES, _value_pool, pool_len);
-            if (flash_res)
-            {
-                DEBUG_LOG("Data write error %d\n", flash_res);
-                continue;
-            }
+            _subscribed[(*link)->indexes[i]] = true;
         }
-
-        DEBUG_LOG("Saved successfully\n");
-        return 0;
+        link = &(*link)->next;
     }
+}
 
-    assert(flash_res);
-    return flash_res;
+int save(const Domain& domain)
+{
+    ASSERT_ALWAYS(_frozen);
+    if ((domain.index >= CONFIG_DOMAINS_MAX) || (_domains[domain.index].storage == nullptr))
+    {
+        return -EINVAL;
+    }
+    ConfigMutexLocker locker(_mutex);
+    os::MutexLocker storage_locker(_storage_mutex);
+    return saveDomainLocked(_domains[domain.index]);
 }
 
-int configErase(void)
+int erase(const Domain& domain)
 {
     ASSERT_ALWAYS(_frozen);
-    os::MutexLocker locker(_mutex);
-    int res = g_storage->erase();
-    if (res >= 0)
+    if (domain.index >= CONFIG_DOMAINS_MAX)
     {
-        reinitializeDefaults();
-        _modification_cnt += 1;
+        return -EINVAL;
     }
-    return res;
+    ConfigMutexLocker locker(_mutex);
+    return eraseLocked(std::bitset<CONFIG_DOMAINS_MAX>().set(domain.index));
 }
 
-const char* configNameByIndex(int index)
+int prepareStorage()
 {
     ASSERT_ALWAYS(_frozen);
-    assert(index >= 0);
-    if (index < 0 || index >= _num_params)
+    os::MutexLocker locker(_storage_mutex);
+    int res = 0;
+    for (DomainState& dom : _domains)
     {
-        return NULL;
+        const int dom_res = (dom.storage != nullptr) ? dom.storage->prepareErase() : 0;
+        res = (res < 0) ? res : dom_res;
     }
-    return _descr_pool[index]->name;
+    return res;
 }
 
-int configSet(const char* name, float value)
+/*
+ * Snapshot: the header followed by the value pool and the bit pool, same as in the stored image.
+ */
+static constexpr std::uint32_t SnapshotMagic = 0x31534643;      // "CFS1"
+
+struct SnapshotHeader
+{
+    std::uint32_t magic;
+    std::uint32_t format_hash;
+    std::uint32_t crc;
+};
+static_assert(sizeof(SnapshotHeader) == 12, "Invalid snapshot header layout");
+
+std::size_t getSnapshotSize()
 {
-    int retval = 0;
     ASSERT_ALWAYS(_frozen);
-    os::MutexLocker locker(_mutex);
+    return sizeof(SnapshotHeader) + _pool_used.values_size + _pool_used.bits_size;
+}
 
-    const int index = indexByName(name);
-    if (index < 0)
+int exportSnapshot(void* buffer, std::size_t size)
+{
+    ASSERT_ALWAYS(_frozen);
+    if ((buffer == nullptr) || (size < getSnapshotSize()))
     {
-        retval = -ENOENT;
-        goto leave;
+        return -ENOSPC;
     }
 
-    if (!isValid(_descr_pool[index], value))
+    auto* const out = static_cast<std::uint8_t*>(buffer);
+    std::uint8_t* const values = out + sizeof(SnapshotHeader);
+    std::uint8_t* const bits = values + _pool_used.values_size;
     {
-        retval = -EINVAL;
-        goto leave;
+        ConfigMutexLocker locker(_mutex);     // The values can't change meanwhile
+#if CONFIG_SPARSE_OVERRIDES_MAX > 0
+        std::memset(values, 0, _pool_used.values_size + _pool_used.bits_size);
+        for (int i = 0; i < numParams(); i++)
+        {
+            insertRaw(_pool_used, values, bits, i, loadRaw(i));
+        }
+#else
+        std::memcpy(values, _value_pool, _pool_used.values_size);
+        std::memcpy(bits, _bit_pool, _pool_used.bits_size);
+#endif
     }
 
-    _modification_cnt += 1;
-    _value_pool[index] = value;
-
-    leave:
-    return retval;
+    const SnapshotHeader header{ SnapshotMagic, _snapshot_hash, computeImageCRC(_pool_used, values, bits) };
+    std::memcpy(out, &header, sizeof(header));
+    return int(getSnapshotSize());
 }
 
-int configGetDescr(const char* name, ConfigParam* out)
+int importSnapshot(const void* buffer, std::size_t size, bool save)
 {
     ASSERT_ALWAYS(_frozen);
-    assert(out);
-    if (!out)
+    SnapshotHeader header{};
+    if ((buffer == nullptr) || (size != getSnapshotSize()))
+    {
+        return -EINVAL;
+    }
+    std::memcpy(&header, buffer, sizeof(header));
+    if (header.magic != SnapshotMagic)
     {
         return -EINVAL;
     }
+    if (header.format_hash != _snapshot_hash)
+    {
+        return -ENOENT;
+    }
 
-    int retval = 0;
-    os::MutexLocker locker(_mutex);
+    const std::uint8_t* const values = static_cast<const std::uint8_t*>(buffer) + sizeof(SnapshotHeader);
+    const std::uint8_t* const bits = values + _pool_used.values_size;
+    if (computeImageCRC(_pool_used, values, bits) != header.crc)
+    {
+        return -EINVAL;
+    }
 
-    const int index = indexByName(name);
-    if (index < 0)
+    // The snapshot is validated before anything is modified
+    for (int i = 0; i < numParams(); i++)
     {
-        retval = -ENOENT;
-        goto leave;
+        if (!isValidRaw(i, extractRaw(_pool_used, values, bits, i)))
+        {
+            return -EINVAL;
+        }
     }
 
-    *out = *_descr_pool[index];
+    ConfigMutexLocker locker(_mutex);
 
-    leave:
-    return retval;
+    const auto raw_of = [values, bits](int index) { return extractRaw(_pool_used, values, bits, index); };
+    const int res = setMultipleByIndex(std::bitset<CONFIG_PARAMS_MAX>().set(), raw_of);
+    if (res < 0)
+    {
+        return res;
+    }
+    return save ? saveLocked() : 0;
 }
 
-float configGet(const char* name)
+/*
+ * Asynchronous save.
+ * The state variables are protected by the kernel lock.
+ */
+static BSEMAPHORE_DECL(_async_save_semaphore, true);
+static EVENTSOURCE_DECL(_async_save_event_source);
+static bool _async_save_running = false;
+static bool _async_save_pending = false;
+static bool _async_save_busy = false;
+static bool _async_save_flush = false;
+static ::systime_t _async_save_pending_since = 0;       ///< When the oldest unserved request was received
+static int _async_save_last_result = 0;
+
+/// The event of the waiting thread that flushAsyncSave() uses; see its documentation
+static constexpr ::eventmask_t AsyncSaveFlushEventMask = EVENT_MASK(31);
+
+static void performAsyncSave()
 {
-    ASSERT_ALWAYS(_frozen);
-    os::MutexLocker locker(_mutex);
-    const int index = indexByName(name);
-    assert(index >= 0);
-    const float val = (index < 0) ? nanf("") : _value_pool[index];
-    assert(std::isfinite(val));
-    return val;
+    chSysLock();
+    _async_save_pending = false;
+    _async_save_flush = false;
+    _async_save_busy = true;
+    chSysUnlock();
+
+    const int res = ::configSave();
+
+    chSysLock();
+    _async_save_busy = false;
+    _async_save_last_result = res;
+    chSysUnlock();
+
+    chEvtBroadcastFlags(&_async_save_event_source, (res < 0) ? AsyncSaveEventFlagFailure : AsyncSaveEventFlagSuccess);
 }
 
-namespace os
-{
-namespace config
-{
+#if CONFIG_ASYNC_SAVE_STACK_SIZE > 0
+static unsigned _async_save_quiet_period_msec = 0;
+static unsigned _async_save_max_latency_msec = 0;
 
-int init(IStorageBackend* storage)
+/**
+ * Returns true if the save should be performed now, otherwise the timeout of the wait for the next request.
+ */
+static bool isAsyncSaveDue(::sysinterval_t& out_timeout)
 {
-    ASSERT_ALWAYS(_num_params <= CONFIG_PARAMS_MAX);  // being paranoid
-    ASSERT_ALWAYS(!_frozen);
+    const ::sysinterval_t max_latency = TIME_MS2I(_async_save_max_latency_msec);
 
-    if (storage == nullptr)
+    os::CriticalSectionLocker locker;
+    const ::sysinterval_t waited = chVTTimeElapsedSinceX(_async_save_pending_since);
+    if (_async_save_flush || (waited >= max_latency))
     {
-        return -EINVAL;
+        return true;
     }
+    out_timeout = std::min<::sysinterval_t>(TIME_MS2I(_async_save_quiet_period_msec), max_latency - waited);
+    return false;
+}
 
-    g_storage = storage;
-
-    _frozen = true;
-
-    reinitializeDefaults();             // Init defaults by default
-
+static class AsyncSaveThread : public chibios_rt::BaseStaticThread<CONFIG_ASYNC_SAVE_STACK_SIZE>
+{
+    void main() override
     {
-        std::uint32_t stored_layout_hash = 0xdeadbeef;
+        setName("config_save");
+        (void)prepareStorage();
 
-        // Read the layout hash
-        for (int attempt = 0; attempt < MaxRetries; attempt++)
+        for (;;)
         {
-            int flash_res = g_storage->read(OFFSET_LAYOUT_HASH, &stored_layout_hash, 4);
-            if (flash_res == 0)
+            (void)chBSemWait(&_async_save_semaphore);
+            if (!_async_save_pending)
             {
-                if (stored_layout_hash == _layout_hash)
-                {
-                    break;
-                }
+                continue;               // Stale signal from a request that has been served already
             }
-        }
-
-        if (stored_layout_hash != _layout_hash)
-        {
-            return InitCodeLayoutMismatch;
-        }
-    }
 
-    // If the layout hash has not changed, we can restore the values safely
-    for (int attempt = 0; attempt < MaxRetries; attempt++)
-    {
-        const int pool_len = _num_params * sizeof(_value_pool[0]);
+            // Every new request restarts the quiet period, so that a burst of requests results in one write;
+            // but a steady stream of requests must not postpone the write forever, hence the maximum latency
+            ::sysinterval_t timeout = 0;
+            while (!isAsyncSaveDue(timeout) &&
+                   (chBSemWaitTimeout(&_async_save_semaphore, timeout) == MSG_OK))
+            {
+            }
 
-        // Read the data
-        int flash_res = g_storage->read(OFFSET_VALUES, _value_pool, pool_len);
-        if (flash_res)
-        {
-            continue;
+            performAsyncSave();
+            (void)prepareStorage();
         }
+    }
+} _async_save_thread;
+#endif
 
-        // Check CRC
-        const std::uint32_t true_crc = crc32(_value_pool, pool_len);
-        std::uint32_t stored_crc = 0;
-        flash_res = g_storage->read(OFFSET_CRC, &stored_crc, 4);
-        if (flash_res || (true_crc != stored_crc))
-        {
-            continue;
-        }
+static bool isAsyncSaveComplete()
+{
+    os::CriticalSectionLocker locker;
+    return !_async_save_pending && !_async_save_busy;
+}
 
-        // Reinitialize defaults if restored values are not valid
-        for (int i = 0; i < _num_params; i++)
+int startAsyncSaveThread(::tprio_t priority, unsigned quiet_period_msec, unsigned max_latency_msec)
+{
+#if CONFIG_ASYNC_SAVE_STACK_SIZE > 0
+    ASSERT_ALWAYS(!_async_save_running);
+    _async_save_quiet_period_msec = quiet_period_msec;
+    _async_save_max_latency_msec = (max_latency_msec > 0) ? std::max(max_latency_msec, quiet_period_msec) :
+                                                            (quiet_period_msec * 4U);
+    _async_save_running = true;
+    (void)_async_save_thread.start(priority);
+
+    os::setRebootPreparationHook([]()
         {
-            if (!isValid(_descr_pool[i], _value_pool[i]))
-            {
-                _value_pool[i] = _descr_pool[i]->default_;
-            }
-        }
+            requestAsyncSaveFlush();
+            return isAsyncSaveComplete();
+        });
+    return 0;
+#else
+    (void)priority;
+    (void)quiet_period_msec;
+    (void)max_latency_msec;
+    return -ENOTSUP;
+#endif
+}
 
-        return InitCodeRestored;
+void saveAsync()
+{
+    if (!_async_save_running)
+    {
+        performAsyncSave();             // Falling back to synchronous save
+        return;
     }
 
-    reinitializeDefaults();
+    os::CriticalSectionLocker locker;
+    if (!_async_save_pending)
+    {
+        _async_save_pending_since = chVTGetSystemTimeX();
+    }
+    _async_save_pending = true;
+    chBSemSignalI(&_async_save_semaphore);
+    chSchRescheduleS();
+}
 
-    return InitCodeCRCMismatch;
+void requestAsyncSaveFlush()
+{
+    os::CriticalSectionLocker locker;
+    if (_async_save_pending)
+    {
+        _async_save_flush = true;
+        chBSemSignalI(&_async_save_semaphore);
+        chSchRescheduleS();
+    }
 }
 
-std::uint16_t getParamCount()
+int flushAsyncSave(unsigned timeout_msec)
 {
-    return std::uint16_t(_num_params);
+    // The listener is registered before the request, so that the completion event can't be missed
+    ::event_listener_t listener;
+    chEvtRegisterMask(&_async_save_event_source, &listener, AsyncSaveFlushEventMask);
+    requestAsyncSaveFlush();
+
+    const auto started_at = chVTGetSystemTimeX();
+    int res = 0;
+    while (!isAsyncSaveComplete())
+    {
+        const ::sysinterval_t elapsed = chVTTimeElapsedSinceX(started_at);
+        if ((elapsed >= TIME_MS2I(timeout_msec)) ||
+            (chEvtWaitAnyTimeout(AsyncSaveFlushEventMask, TIME_MS2I(timeout_msec) - elapsed) == 0))
+        {
+            res = -ETIMEDOUT;
+            break;
+        }
+    }
+    chEvtUnregister(&_async_save_event_source, &listener);
+    (void)chEvtGetAndClearEvents(AsyncSaveFlushEventMask);     // A late event must not leak to the caller
+
+    if (res == 0)
+    {
+        os::CriticalSectionLocker locker;
+        res = _async_save_last_result;
+    }
+    return res;
 }
 
-unsigned getModificationCounter()
+::event_source_t& getAsyncSaveEventSource()
 {
-    return _modification_cnt;           // Atomic access
+    return _async_save_event_source;
 }
 
 
 template <typename T>
 static inline ParamMetadataPointer constructParamPointer(const int index)
 {
-    return ParamMetadataPointer(std::in_place_type<Param<T>*>, static_cast<Param<T>*>(_descr_pool[index]));
+    return ParamMetadataPointer(std::in_place_type<Param<T>*>, static_cast<Param<T>*>(descr(index)));
 }
 
-template <std::size_t CandidateTypeIndex = 0>
-ParamMetadataPointer deduceSmallestIntegralParamType(const ::ConfigParam& desc, const int index)
+#if !CONFIG_STATIC_REGISTRY
+/*
+ * Param<> copies of the descriptors of the C params, see CONFIG_C_PARAM_METADATA_MAX. Protected by the mutex;
+ * a copy is immutable once constructed.
+ */
+using CParamMetadata = std::variant<
+    std::monostate,
+    _internal::Param<bool>,
+    _internal::Param<std::uint8_t >, _internal::Param<std::int8_t >,
+    _internal::Param<std::uint16_t>, _internal::Param<std::int16_t>,
+    _internal::Param<std::uint32_t>, _internal::Param<std::int32_t>,
+    _internal::Param<std::uint64_t>, _internal::Param<std::int64_t>,
+    _internal::Param<float>
+>;
+
+static CParamMetadata _c_param_metadata[CONFIG_C_PARAM_METADATA_MAX];
+static int _c_param_metadata_indexes[CONFIG_C_PARAM_METADATA_MAX];
+static std::size_t _num_c_param_metadata = 0;
+
+/**
+ * The descriptor may specify the limits beyond the range of the native type; they are clamped.
+ */
+template <typename T>
+static inline T toNativeMetadata(float value)
 {
-    if constexpr (CandidateTypeIndex < std::variant_size_v<ParamMetadataPointer>)
+    if constexpr (std::is_integral_v<T> && !std::is_same_v<T, bool>)
     {
-        using T = typename std::remove_pointer_t<std::variant_alternative_t<CandidateTypeIndex,
-                                                                            ParamMetadataPointer>>::Type;
-        if constexpr (std::is_integral_v<T>)
+        if (double(value) <= double(std::numeric_limits<T>::min()))
         {
-            constexpr auto min = float(std::numeric_limits<T>::min());
-            constexpr auto max = float(std::numeric_limits<T>::max());
-            if ((min <= desc.min) && (desc.max <= max))
-            {
-                return constructParamPointer<T>(index);
-            }
-            else
-            {
-                return deduceSmallestIntegralParamType<CandidateTypeIndex + 1>(desc, index);
-            }
+            return std::numeric_limits<T>::min();
+        }
+        if (double(value) >= double(std::numeric_limits<T>::max()))
+        {
+            return std::numeric_limits<T>::max();
         }
+        return T(std::round(value));
     }
+    else
+    {
+        return T(value);
+    }
+}
 
-    // We got through all of the types and couldn't find one matching - last resort is return as float
-    return constructParamPointer<float>(index);
+template <typename T>
+static ParamMetadataPointer constructCParamMetadata(std::size_t slot, int index)
+{
+    const ConfigParam* const d = descr(index);
+    const Domain domain{ d->domain, nullptr };
+    auto& param = _c_param_metadata[slot].emplace<_internal::Param<T>>(_internal::StaticIndex{ index }, domain,
+                                                                      ::configNameByIndex(index),
+                                                                      toNativeMetadata<T>(d->default_),
+                                                                      toNativeMetadata<T>(d->min),
+                                                                      toNativeMetadata<T>(d->max));
+    return ParamMetadataPointer(std::in_place_type<Param<T>*>, &param);
 }
 
+static std::optional<ParamMetadataPointer> getCParamMetadata(int index)
+{
+    ConfigMutexLocker locker(_mutex);
+
+    for (std::size_t i = 0; i < _num_c_param_metadata; i++)
+    {
+        if (_c_param_metadata_indexes[i] == index)
+        {
+            return std::visit([](auto& param) -> std::optional<ParamMetadataPointer>
+                {
+                    using P = std::decay_t<decltype(param)>;
+                    if constexpr (std::is_same_v<P, std::monostate>)
+                    {
+                        return {};
+                    }
+                    else
+                    {
+                        return ParamMetadataPointer(std::in_place_type<const P*>, &param);
+                    }
+                }, _c_param_metadata[i]);
+        }
+    }
+
+    if (_num_c_param_metadata >= CONFIG_C_PARAM_METADATA_MAX)
+    {
+        return {};
+    }
+
+    const std::size_t slot = _num_c_param_metadata++;
+    _c_param_metadata_indexes[slot] = index;
+    return visitNativeType(kindOf(descr(index)),
+                           [slot, index](auto tag) { return constructCParamMetadata<decltype(tag)>(slot, index); });
+}
+#endif
 
 std::optional<ParamMetadataPointer> getParamMetadata(const char* name)
 {
-    // Locking is not required here, all access is read-only and the data is immutable
     const int index = (name == nullptr) ? -1 : indexByName(name);
     if (index < 0)
     {
         return {};
     }
 
-    const auto desc = *_descr_pool[index];
+#if !CONFIG_STATIC_REGISTRY
+    // Descriptors registered via the C API are not Param<> instances, so they can't be pointed to as such
+    if (!_typed_params[index])
+    {
+        return getCParamMetadata(index);
+    }
+#endif
+
+    // Locking is not required here, the descriptors are immutable
+    return visitNativeType(kindOf(descr(index)),
+                           [index](auto tag) { return constructParamPointer<decltype(tag)>(index); });
+}
 
-    if (desc.type == CONFIG_TYPE_BOOL)
+#if CONFIG_INSTRUMENTATION
+ParamAccessCounters getParamAccessCounters(std::uint16_t index)
+{
+    ParamAccessCounters out{};
+    if (index < numParams())
     {
-        return constructParamPointer<bool>(index);
+        const ParamAccessCounters& c = _access_counters[index];
+        out.gets    = __atomic_load_n(&c.gets,    __ATOMIC_RELAXED);
+        out.sets    = __atomic_load_n(&c.sets,    __ATOMIC_RELAXED);
+        out.lookups = __atomic_load_n(&c.lookups, __ATOMIC_RELAXED);
     }
+    return out;
+}
 
-    if (desc.type == CONFIG_TYPE_FLOAT)
+AccessStatistics getAccessStatistics()
+{
+    // The plain locker, so that getting the statistics does not change them
+    os::MutexLocker locker(_mutex);
+    AccessStatistics out = _access_stats;
+    for (unsigned i = 0; i < AccessStatistics::LookupCostHistogramSize; i++)
     {
-        return constructParamPointer<float>(index);
+        out.lookup_cost_histogram[i] = __atomic_load_n(&_access_stats.lookup_cost_histogram[i], __ATOMIC_RELAXED);
     }
+    return out;
+}
 
-    assert(desc.type == CONFIG_TYPE_INT);
-    return deduceSmallestIntegralParamType(desc, index);
+void resetAccessStatistics()
+{
+    os::MutexLocker locker(_mutex);
+    for (ParamAccessCounters& c : _access_counters)
+    {
+        __atomic_store_n(&c.gets,    0U, __ATOMIC_RELAXED);
+        __atomic_store_n(&c.sets,    0U, __ATOMIC_RELAXED);
+        __atomic_store_n(&c.lookups, 0U, __ATOMIC_RELAXED);
+    }
+    _access_stats.locks = 0;
+    _access_stats.contended_locks = 0;
+    _access_stats.lock_wait_total = 0;
+    _access_stats.lock_wait_max = 0;
+    _access_stats.saves = 0;
+    _access_stats.save_duration_total = 0;
+    _access_stats.save_duration_max = 0;
+    _access_stats.erase_duration_total = 0;
+    _access_stats.program_duration_total = 0;
+    for (std::uint32_t& x : _access_stats.lookup_cost_histogram)
+    {
+        __atomic_store_n(&x, 0U, __ATOMIC_RELAXED);
+    }
 }
+#endif
 
 }
 }
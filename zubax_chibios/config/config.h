@@ -7,6 +7,7 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -19,6 +20,24 @@ typedef enum
     CONFIG_TYPE_BOOL
 } ConfigDataType;
 
+/**
+ * Native type of the value of an integer param; the value is stored in this type in RAM and in the storage.
+ * Float params are always stored as float, bool params are stored as single bits.
+ * The default, min, and max values are float, so they are exact only up to 2^24.
+ */
+typedef enum
+{
+    CONFIG_STORAGE_AUTO,        ///< Signed 32-bit integer
+    CONFIG_STORAGE_UINT8,
+    CONFIG_STORAGE_INT8,
+    CONFIG_STORAGE_UINT16,
+    CONFIG_STORAGE_INT16,
+    CONFIG_STORAGE_UINT32,
+    CONFIG_STORAGE_INT32,
+    CONFIG_STORAGE_UINT64,
+    CONFIG_STORAGE_INT64
+} ConfigStorageType;
+
 typedef struct
 {
     const char* name;
@@ -26,6 +45,9 @@ typedef struct
     float min;
     float max;
     ConfigDataType type;
+    ConfigStorageType storage;
+    uint8_t domain;             ///< See os::config::Domain; the params defined via the macros below use the default one
+    uint16_t length;            ///< Number of elements of an array param (see os::config::ParamArray<>), zero otherwise
 } ConfigParam;
 
 
@@ -36,7 +58,7 @@ typedef struct
 
 #define CONFIG_PARAM_RAW_(name, default_, min, max, type)             \
     static const ConfigParam GLUE(_config_local_param_, __LINE__) =   \
-        {name, default_, min, max, type};                             \
+        {name, default_, min, max, type, CONFIG_STORAGE_AUTO, 0, 0};  \
     __attribute__((constructor, unused))                              \
     static void GLUE(_config_local_constructor_, __LINE__)(void) {    \
         configRegisterParam_(&GLUE(_config_local_param_, __LINE__));  \
@@ -59,16 +81,21 @@ void configRegisterParam_(const ConfigParam* param);
 /**
  * Saves the config into the non-volatile memory.
  * May enter a huge critical section, so it shall never be called concurrently with hard real time processes.
+ * Does nothing if no params were modified since the last save; only the domains that contain modified params
+ * are written.
+ * @return Number of modified params that were saved, negative errno on failure.
  */
 int configSave(void);
 
 /**
- * Erases the configuration from the non-volatile memory; current parameter values will not be affected.
+ * Erases the configuration of all domains from the non-volatile memory, and resets the params to the defaults.
  * Same warning as for @ref configSave()
  */
 int configErase(void);
 
 /**
+ * Every element of an array param has its own index and its own name "name[k]", where k is the zero-based element
+ * number; the name is accepted by the functions below. The name of the array alone refers to its first element.
  * @param [in] index Non-negative parameter index
  * @return Name, or NULL if the index is out of range
  */
@@ -76,7 +103,7 @@ const char* configNameByIndex(int index);
 
 /**
  * @param [in] name  Parameter name
- * @param [in] value Parameter value
+ * @param [in] value Parameter value; it is rounded to the nearest integer if the parameter is integer
  * @return 0 if the parameter does exist and the value is valid, negative errno otherwise.
  */
 int configSet(const char* name, float value);
@@ -91,6 +118,7 @@ int configGetDescr(const char* name, ConfigParam* out);
 /**
  * @param [in] name Parameter name
  * @return The parameter value if it does exist; otherwise fires an assert() in debug builds, returns NAN in release.
+ * The value of a 64-bit integer parameter may be rounded. This function is lock-free.
  */
 float configGet(const char* name);
 
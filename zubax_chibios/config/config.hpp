@@ -8,21 +8,196 @@
 
 #include <type_traits>
 #include <functional>
+#include <array>
 #include <variant>
 #include <optional>
+#include <tuple>
+#include <limits>
+#include <cerrno>
 #include <cstdint>
+#include <cassert>
+#include <ch.hpp>
 #include "config.h"
 
+/*
+ * Collection of the access statistics, see os::config::getAccessStatistics(). Disabled by default, because the
+ * counters are updated on every access, and they take RAM for every param.
+ */
+#ifndef CONFIG_INSTRUMENTATION
+#  define CONFIG_INSTRUMENTATION        0
+#endif
+
 
 namespace os
 {
 namespace config
 {
+/**
+ * Params are grouped into domains, each of which is kept in its own storage, so that it is saved and erased
+ * independently of the others. For example, the factory calibration, the user settings, and the runtime statistics
+ * can be kept in separate domains; then saving a frequently changed domain does not rewrite the others.
+ * Every param belongs to one domain; the default domain is used unless specified otherwise at definition.
+ * The number of domains is limited by CONFIG_DOMAINS_MAX, which defaults to one.
+ *
+ * Usage:
+ *      static constexpr os::config::Domain CalibrationDomain{ 1, "calibration" };
+ *      static os::config::Param<float> param_offset(CalibrationDomain, "cal.offset", 0.F, -1.F, 1.F);
+ *      ...
+ *      os::config::attachStorage(CalibrationDomain, &calibration_storage);
+ *      os::config::init(&default_storage);
+ */
+struct Domain
+{
+    std::uint8_t index;         ///< Less than CONFIG_DOMAINS_MAX
+    const char* name;           ///< For diagnostics
+};
+
+constexpr Domain DefaultDomain{ 0, "default" };
+
 /**
  * Implementation details, do not use directly.
  */
 namespace _internal
 {
+/**
+ * CRC-32 step used for the layout hash; it is constexpr because the hash can be computed at compile time.
+ */
+constexpr std::uint32_t crc32Step(std::uint32_t crc, std::uint8_t new_byte)
+{
+    crc = crc ^ std::uint32_t(new_byte);
+    for (int j = 7; j >= 0; j--)
+    {
+        crc = (crc >> 1) ^ (0xEDB88320U & -(crc & 1U));
+    }
+    return crc;
+}
+
+/**
+ * Index of a param that is registered already, e.g. defined in the compile-time registry (see static_registry.hpp);
+ * a Param<> constructed with it does not register itself.
+ */
+struct StaticIndex
+{
+    int value;
+};
+
+/**
+ * Maps integer types onto the fixed-width types they are stored as.
+ */
+template <std::size_t Size, bool Signed> struct IntegerStorage;
+template <> struct IntegerStorage<1, false> { using Type = std::uint8_t;  static constexpr auto Id = CONFIG_STORAGE_UINT8;  };
+template <> struct IntegerStorage<1, true>  { using Type = std::int8_t;   static constexpr auto Id = CONFIG_STORAGE_INT8;   };
+template <> struct IntegerStorage<2, false> { using Type = std::uint16_t; static constexpr auto Id = CONFIG_STORAGE_UINT16; };
+template <> struct IntegerStorage<2, true>  { using Type = std::int16_t;  static constexpr auto Id = CONFIG_STORAGE_INT16;  };
+template <> struct IntegerStorage<4, false> { using Type = std::uint32_t; static constexpr auto Id = CONFIG_STORAGE_UINT32; };
+template <> struct IntegerStorage<4, true>  { using Type = std::int32_t;  static constexpr auto Id = CONFIG_STORAGE_INT32;  };
+template <> struct IntegerStorage<8, false> { using Type = std::uint64_t; static constexpr auto Id = CONFIG_STORAGE_UINT64; };
+template <> struct IntegerStorage<8, true>  { using Type = std::int64_t;  static constexpr auto Id = CONFIG_STORAGE_INT64;  };
+
+template <typename T>
+using IntegerStorageOf = IntegerStorage<sizeof(T), std::is_signed_v<T>>;
+
+/**
+ * Type of the value as it is stored by the config module: bool, float, or one of the fixed-width integers.
+ */
+template <typename T>
+using NativeType = std::conditional_t<std::is_same_v<T, bool>, bool,
+                   std::conditional_t<std::is_floating_point_v<T>, float,
+                                      typename IntegerStorageOf<T>::Type>>;
+
+template <typename T>
+constexpr ::ConfigStorageType storageTypeOf()
+{
+    if constexpr (std::is_integral_v<T> && !std::is_same_v<T, bool>)
+    {
+        return IntegerStorageOf<T>::Id;
+    }
+    else
+    {
+        return CONFIG_STORAGE_AUTO;
+    }
+}
+
+template <typename T>
+constexpr bool isWithinRangeOf(double value)
+{
+    return (value >= double(std::numeric_limits<T>::min())) && (value <= double(std::numeric_limits<T>::max()));
+}
+
+/**
+ * Whether the value of an integer param is representable by its native type; the upper limit of 64-bit types
+ * is not exact, such values are saturated.
+ */
+constexpr bool isWithinIntegerStorageRange(::ConfigStorageType storage, double value)
+{
+    switch (storage)
+    {
+    case CONFIG_STORAGE_UINT8:  return isWithinRangeOf<std::uint8_t>(value);
+    case CONFIG_STORAGE_INT8:   return isWithinRangeOf<std::int8_t>(value);
+    case CONFIG_STORAGE_UINT16: return isWithinRangeOf<std::uint16_t>(value);
+    case CONFIG_STORAGE_INT16:  return isWithinRangeOf<std::int16_t>(value);
+    case CONFIG_STORAGE_UINT32: return isWithinRangeOf<std::uint32_t>(value);
+    case CONFIG_STORAGE_UINT64: return isWithinRangeOf<std::uint64_t>(value);
+    case CONFIG_STORAGE_INT64:  return isWithinRangeOf<std::int64_t>(value);
+    case CONFIG_STORAGE_AUTO:
+    case CONFIG_STORAGE_INT32:
+    default:                    return isWithinRangeOf<std::int32_t>(value);
+    }
+}
+
+/**
+ * Registers the param like configRegisterParam_() and returns its index in the value pool.
+ * The index never changes afterwards, so it is resolved once per param instead of searching by name on every access.
+ */
+int registerParam(const ::ConfigParam* param);
+
+/**
+ * Index-based counterparts of configGet() and configSet(); complexity is O(1).
+ * T is the native type of the value (see NativeType<>); if it does not match the type of the param, the value
+ * is converted.
+ */
+template <typename T> T getValueByIndex(int index);
+template <typename T> int setValueByIndex(int index, T value);
+
+/**
+ * Sets the values of the params at the consecutive indexes starting from the specified one under one lock.
+ * Nothing is modified if any of the values is invalid.
+ */
+template <typename T> int setValuesByIndex(int index, const T* values, std::size_t count);
+
+/**
+ * Validated value of a param converted to its native type; see Transaction<>.
+ */
+struct StagedValue
+{
+    std::uint64_t raw;
+    std::uint16_t index;
+};
+
+/**
+ * Validates the value and converts it to the native type of the param. Returns negative errno if invalid.
+ */
+template <typename T> int stageValue(int index, T value, StagedValue& out);
+int stageValue(const char* name, float value, StagedValue& out);
+
+/**
+ * Assigns the staged values under one lock; returns the result of the save if requested, zero otherwise.
+ */
+int commitStagedValues(const StagedValue* values, std::size_t num_values, bool save);
+
+/**
+ * Seqlock reader interface: a read section is consistent if endRead() returned true for the value returned by
+ * the preceding beginRead(). Otherwise the read section must be repeated. Neither function ever takes a lock.
+ * beginRead() spins while a modification is in progress on another core; the modifications are performed in
+ * critical sections, so this can't happen on a single core. Therefore, beginRead() must not be called from an ISR,
+ * including the fast interrupts that are not masked by the critical sections, nor from within a modification;
+ * the interrupted modification would never complete, and the reader would spin forever. The same applies to the
+ * getters of the 64-bit params, and to all getters in the sparse mode (CONFIG_SPARSE_OVERRIDES_MAX), which read
+ * the values this way.
+ */
+unsigned beginRead();
+bool endRead(unsigned seq);
+
 /**
  * A convenient typesafe wrapper that hides the ugly C API.
  * Someday in the future this will have to be re-implemented into a proper, better library.
@@ -39,23 +214,51 @@ struct Param : public ::ConfigParam
 
     static_assert(std::is_floating_point<T>() || std::is_integral<T>(), "One does not simply use T here");
 
-    Param(const char* arg_name, T arg_default, T arg_min, T arg_max) : ConfigParam
+    const int index;
+
+    Param(const Domain& arg_domain, const char* arg_name, T arg_default, T arg_min, T arg_max) : ConfigParam
     {
         arg_name,
         float(arg_default),
         float(arg_min),
         float(arg_max),
-        std::is_floating_point<T>() ? CONFIG_TYPE_FLOAT : CONFIG_TYPE_INT
-    }
-    {
-        ::configRegisterParam_(this);
-    }
-
-    T get() const { return T(::configGet(name)); }
+        std::is_floating_point<T>() ? CONFIG_TYPE_FLOAT : CONFIG_TYPE_INT,
+        storageTypeOf<T>(),
+        arg_domain.index,
+        0
+    },
+        index(registerParam(this))
+    { }
+
+    Param(const char* arg_name, T arg_default, T arg_min, T arg_max) :
+        Param(DefaultDomain, arg_name, arg_default, arg_min, arg_max)
+    { }
+
+    constexpr Param(StaticIndex static_index, const Domain& arg_domain, const char* arg_name,
+                    T arg_default, T arg_min, T arg_max) :
+        ConfigParam
+        {
+            arg_name,
+            float(arg_default),
+            float(arg_min),
+            float(arg_max),
+            std::is_floating_point<T>() ? CONFIG_TYPE_FLOAT : CONFIG_TYPE_INT,
+            storageTypeOf<T>(),
+            arg_domain.index,
+            0
+        },
+        index(static_index.value)
+    { }
+
+    constexpr Param(StaticIndex static_index, const char* arg_name, T arg_default, T arg_min, T arg_max) :
+        Param(static_index, DefaultDomain, arg_name, arg_default, arg_min, arg_max)
+    { }
+
+    T get() const { return T(getValueByIndex<NativeType<T>>(index)); }
 
     int set(const T& value) const
     {
-        return ::configSet(name, float(value));
+        return setValueByIndex<NativeType<T>>(index, NativeType<T>(value));
     }
 
     int setAndSave(const T& value) const
@@ -68,6 +271,11 @@ struct Param : public ::ConfigParam
         return ::configSave();
     }
 
+    /**
+     * Like setAndSave(), but the configuration is saved by the background thread; see os::config::saveAsync().
+     */
+    int setAndSaveAsync(const T& value) const;
+
     bool isMin() const { return get() <= T(::ConfigParam::min); }
     bool isMax() const { return get() >= T(::ConfigParam::max); }
 
@@ -83,24 +291,53 @@ struct Param<bool> : public ::ConfigParam
 
     using ::ConfigParam::name;
 
-    Param(const char* arg_name, bool arg_default) : ConfigParam
+    const int index;
+
+    Param(const Domain& arg_domain, const char* arg_name, bool arg_default) : ConfigParam
     {
         arg_name,
         arg_default ? 1.F : 0.F,
         0.F,
         1.F,
-        CONFIG_TYPE_BOOL
-    }
-    {
-        ::configRegisterParam_(this);
-    }
-
-    bool get() const { return ::configGet(name) > 1e-6F; }
+        CONFIG_TYPE_BOOL,
+        CONFIG_STORAGE_AUTO,
+        arg_domain.index,
+        0
+    },
+        index(registerParam(this))
+    { }
+
+    Param(const char* arg_name, bool arg_default) :
+        Param(DefaultDomain, arg_name, arg_default)
+    { }
+
+    constexpr Param(StaticIndex static_index, const Domain& arg_domain, const char* arg_name, bool arg_default,
+                    bool /* arg_min */ = false, bool /* arg_max */ = true) :
+        ConfigParam
+        {
+            arg_name,
+            arg_default ? 1.F : 0.F,
+            0.F,
+            1.F,
+            CONFIG_TYPE_BOOL,
+            CONFIG_STORAGE_AUTO,
+            arg_domain.index,
+            0
+        },
+        index(static_index.value)
+    { }
+
+    constexpr Param(StaticIndex static_index, const char* arg_name, bool arg_default,
+                    bool arg_min = false, bool arg_max = true) :
+        Param(static_index, DefaultDomain, arg_name, arg_default, arg_min, arg_max)
+    { }
+
+    bool get() const { return getValueByIndex<bool>(index); }
     operator bool() const { return get(); }
 
     int set(bool value) const
     {
-        return ::configSet(name, float(value));
+        return setValueByIndex<bool>(index, value);
     }
 
     int setAndSave(bool value) const
@@ -113,11 +350,119 @@ struct Param<bool> : public ::ConfigParam
         return ::configSave();
     }
 
+    /**
+     * Like setAndSave(), but the configuration is saved by the background thread; see os::config::saveAsync().
+     */
+    int setAndSaveAsync(bool value) const;
+
     bool getDefaultValue() const { return ::ConfigParam::default_ > 1e-6F; }
     bool getMinValue()     const { return false; }
     bool getMaxValue()     const { return true; }
 };
 
+template <typename T, std::size_t N>
+struct ParamArray : public ::ConfigParam
+{
+    using Type = T;
+
+    using ::ConfigParam::name;
+
+    ParamArray(const ParamArray&) = delete;
+    ParamArray& operator=(const ParamArray&) = delete;
+
+    static_assert(std::is_floating_point<T>() || (std::is_integral<T>() && !std::is_same<T, bool>()),
+                  "One does not simply use T here");
+    static_assert((N > 0) && (N <= 0xFFFFU), "Invalid length");
+
+    const int index;            ///< Of the first element; the elements have consecutive indexes
+
+    ParamArray(const Domain& arg_domain, const char* arg_name, T arg_default, T arg_min, T arg_max) : ConfigParam
+    {
+        arg_name,
+        float(arg_default),
+        float(arg_min),
+        float(arg_max),
+        std::is_floating_point<T>() ? CONFIG_TYPE_FLOAT : CONFIG_TYPE_INT,
+        storageTypeOf<T>(),
+        arg_domain.index,
+        std::uint16_t(N)
+    },
+        index(registerParam(this))
+    { }
+
+    ParamArray(const char* arg_name, T arg_default, T arg_min, T arg_max) :
+        ParamArray(DefaultDomain, arg_name, arg_default, arg_min, arg_max)
+    { }
+
+    static constexpr std::size_t size() { return N; }
+
+    /**
+     * The element number must be less than N.
+     */
+    T get(std::size_t element) const
+    {
+        assert(element < N);
+        return T(getValueByIndex<NativeType<T>>(index + int(element)));
+    }
+
+    /**
+     * Reads all elements such that they are mutually consistent, like os::config::getConsistent().
+     */
+    std::array<T, N> getAll() const
+    {
+        std::array<T, N> out{};
+        for (;;)
+        {
+            const unsigned seq = beginRead();
+            for (std::size_t i = 0; i < N; i++)
+            {
+                out[i] = get(i);
+            }
+            if (endRead(seq))
+            {
+                return out;
+            }
+        }
+    }
+
+    /**
+     * Every element is validated against the limits of the array.
+     * @return Zero on success, -EINVAL if the element number is out of range or if the value is invalid.
+     */
+    int set(std::size_t element, const T& value) const
+    {
+        if (element >= N)
+        {
+            return -EINVAL;
+        }
+        return setValueByIndex<NativeType<T>>(index + int(element), NativeType<T>(value));
+    }
+
+    /**
+     * Sets all elements at once, like Transaction<>::commit(); nothing is modified if any of the values is invalid.
+     */
+    int setAll(const std::array<T, N>& values) const
+    {
+        if constexpr (std::is_same_v<T, NativeType<T>>)
+        {
+            return setValuesByIndex<T>(index, values.data(), N);
+        }
+        else
+        {
+            std::array<NativeType<T>, N> native{};
+            for (std::size_t i = 0; i < N; i++)
+            {
+                native[i] = NativeType<T>(values[i]);
+            }
+            return setValuesByIndex<NativeType<T>>(index, native.data(), N);
+        }
+    }
+
+    T getDefaultValue() const { return T(::ConfigParam::default_); }
+    T getMinValue()     const { return T(::ConfigParam::min); }
+    T getMaxValue()     const { return T(::ConfigParam::max); }
+};
+
 } // namespace _internal
 
 /**
@@ -131,13 +476,130 @@ struct Param<bool> : public ::ConfigParam
  * Usage:
  *      double my_data = param_baz ? (moon_phase * param_foo.get()) : (mercury_phase * param_bar.get());
  *
- * Parameter value access complexity is O(N) where N is the total number of params.
+ * Parameter value access complexity is O(1): the index of the param is resolved once during registration.
+ * Values are stored in their native types, so that integers are exact, and bool params take one bit each.
+ * Reads are lock-free, they never block even if the configuration is being modified or saved concurrently.
+ * The C API (configGet(), configSet()) still searches by name, it is intended for external tooling only.
  *
  * Thanks for attending the class.
  */
 template <typename T>
 using Param = const typename _internal::Param<T>;
 
+/**
+ * Array param, e.g. a calibration table: the elements share one name, one descriptor, and the limits, so that
+ * a table doesn't have to be defined as a set of scalar params named like "cal.t0".."cal.t63".
+ * The elements are stored contiguously, and they are validated and persisted like the values of the scalar params.
+ * Arrays of bool are not supported. Every element takes one of CONFIG_PARAMS_MAX entries, and its name like
+ * "cal.thermistor[3]" takes space in the pool of CONFIG_ELEMENT_NAME_POOL_SIZE bytes.
+ *
+ * Usage:
+ *      static os::config::ParamArray<float, 64> param_thermistor("cal.thermistor", 0.F, -1.F, 1.F);
+ *      ...
+ *      const float x = param_thermistor.get(3);
+ *      const auto table = param_thermistor.getAll();
+ */
+template <typename T, std::size_t N>
+using ParamArray = const typename _internal::ParamArray<T, N>;
+
+/**
+ * Reads the values of several params such that they are mutually consistent, i.e. a concurrent modification
+ * is either fully visible in the result or not visible at all. This function never blocks, but it must not be
+ * called from an ISR; see beginRead().
+ *
+ * Usage:
+ *      const auto [gain, offset] = getConsistent(param_gain, param_offset);
+ */
+template <typename... Ts>
+inline std::tuple<Ts...> getConsistent(const _internal::Param<Ts>&... params)
+{
+    for (;;)
+    {
+        const unsigned seq = _internal::beginRead();
+        const std::tuple<Ts...> out(params.get()...);
+        if (_internal::endRead(seq))
+        {
+            return out;
+        }
+    }
+}
+
+/**
+ * Modifies a batch of params at once, e.g. to apply a tuning profile.
+ * The values are validated as they are staged; then either all of them are committed, or none if any of them
+ * turned out to be invalid. The commit takes the lock once and increments the modification counter once, and
+ * getConsistent() observes either none or all of the modifications.
+ *
+ * Usage:
+ *      os::config::Transaction<8> transaction;
+ *      transaction.set(param_gain, 1.5F);
+ *      transaction.set("ctl.period", 20);              // Via the C API name lookup, slower
+ *      const int res = transaction.commit(true);       // Also saves the configuration
+ */
+template <std::size_t Capacity>
+class Transaction
+{
+    std::array<_internal::StagedValue, Capacity> values_{};
+    std::size_t num_values_ = 0;
+    int error_ = 0;
+
+    int accept(int res)
+    {
+        if (res < 0)
+        {
+            error_ = (error_ < 0) ? error_ : res;
+            return res;
+        }
+        num_values_++;
+        return 0;
+    }
+
+public:
+    /**
+     * @return Zero if the value is staged, negative errno if it is invalid or if the capacity is exhausted.
+     */
+    template <typename T>
+    int set(const _internal::Param<T>& param, const typename _internal::Param<T>::Type& value)
+    {
+        if (num_values_ >= Capacity)
+        {
+            return accept(-ENOSPC);
+        }
+        using N = _internal::NativeType<T>;
+        return accept(_internal::stageValue<N>(param.index, N(value), values_[num_values_]));
+    }
+
+    int set(const char* name, float value)
+    {
+        if (num_values_ >= Capacity)
+        {
+            return accept(-ENOSPC);
+        }
+        return accept(_internal::stageValue(name, value, values_[num_values_]));
+    }
+
+    /**
+     * Nothing is modified if any of the values failed to stage; the first error is returned in this case.
+     * The transaction is empty afterwards in any case.
+     * @param save      Save the configuration afterwards, see @ref save().
+     * @return          Result of the save if requested, otherwise zero; negative errno on failure.
+     */
+    int commit(bool save = false)
+    {
+        const int res = (error_ < 0) ? error_ : _internal::commitStagedValues(values_.data(), num_values_, save);
+        reset();
+        return res;
+    }
+
+    void reset()
+    {
+        num_values_ = 0;
+        error_ = 0;
+    }
+
+    std::size_t getSize() const { return num_values_; }
+};
+
 /**
  * This interface abstracts the configuration storage.
  */
@@ -149,36 +611,260 @@ public:
     virtual int read(std::size_t offset, void* data, std::size_t len) = 0;
     virtual int write(std::size_t offset, const void* data, std::size_t len) = 0;
     virtual int erase() = 0;
+
+    /**
+     * Returns a pointer to the specified range of the storage if it is memory-mapped, nullptr otherwise.
+     * This allows the config module to validate the stored data in place instead of reading it out.
+     * The pointer is valid until the next write() or erase().
+     */
+    virtual const void* map(std::size_t offset, std::size_t len)
+    {
+        (void)offset;
+        (void)len;
+        return nullptr;
+    }
+
+    /**
+     * Size of the storage in bytes; zero if unknown.
+     * The journaled storage format (CONFIG_STORAGE_JOURNAL) requires the size to be known, and also it requires
+     * that the erased space can be written in small increments without erasing it again, like NOR flash.
+     */
+    virtual std::size_t getSize() const { return 0; }
+
+    /**
+     * Invoked after everything written since the last erase() is complete, also after the erase() alone.
+     * Backends that keep multiple copies of the data make the new copy current here.
+     */
+    virtual int commit() { return 0; }
+
+    /**
+     * Performs the slow part of the next erase() in advance, e.g. erases the standby copy, so that the next save
+     * is fast. Invoked from the background (see @ref prepareStorage()); may take a long time.
+     */
+    virtual int prepareErase() { return 0; }
 };
 
+/**
+ * Binds the storage to the domain; this must be done before init() for every domain that contains params,
+ * except the default domain, whose storage is passed to init(). A storage can't be shared between domains.
+ * @return Zero on success, -EINVAL if the domain index is out of range.
+ */
+int attachStorage(const Domain& domain, IStorageBackend* storage);
+
 /**
  * Returns 0 if everything is OK, even if the configuration could not be restored (this is not an error).
+ * The configuration of every domain is restored independently; the result refers to the default domain.
  * All other interface functions assume that the config module was initialized successfully.
- * Returns negative errno in case of unrecoverable fault.
+ * Returns negative errno in case of unrecoverable fault, e.g. if a domain that contains params has no storage.
+ * In the sparse mode (CONFIG_SPARSE_OVERRIDES_MAX), returns -ENOSPC if some of the stored values did not fit the
+ * override table. The module is initialized in this case, but the affected params are left at their defaults.
+ * The storage of the affected domains is not compacted until they are erased, as that would lose the values;
+ * if a save needs compaction, it fails with -ENOSPC. The values are restored once the table is made larger.
  */
 int init(IStorageBackend* storage);
 
 /**
- * Total number of known configuration parameters.
+ * Total number of known configuration parameters; every element of an array param is counted.
  */
 std::uint16_t getParamCount();
 
 /**
  * Returns the number of times configSet() was executed successfully.
  * The returned value can only grow (with overflow).
- * This value can be used to reload changed parameter values in the background.
+ * This value can be used to reload changed parameter values in the background; see also ChangeSubscription<>.
  */
 unsigned getModificationCounter();
 
+/**
+ * Returns the number of params that were modified since the configuration was last saved, restored, or erased.
+ * This can be used to decide when to save the configuration, e.g. to batch saves of multiple changes.
+ * If a domain was restored from an outdated storage format or from a damaged journal, all of its params are counted
+ * as unsaved after init(), because the next save rewrites the domain in the current format.
+ */
+unsigned getUnsavedParamCount();
+
+namespace _internal
+{
+/**
+ * Type-erased part of ChangeSubscription<>.
+ */
+struct ChangeSubscriptionBase
+{
+    using Callback = std::function<void (::eventflags_t changed)>;
+
+    ChangeSubscriptionBase* next = nullptr;
+    const ::ConfigParam* const* const params;
+    std::uint16_t* const indexes;               ///< Resolved when subscribed
+    const std::uint8_t num_params;
+    ::event_source_t event_source;
+    Callback callback;
+
+    ChangeSubscriptionBase(const ::ConfigParam* const* arg_params, std::uint16_t* arg_indexes,
+                           std::uint8_t arg_num_params) :
+        params(arg_params),
+        indexes(arg_indexes),
+        num_params(arg_num_params)
+    {
+        chEvtObjectInit(&event_source);
+    }
+
+    ChangeSubscriptionBase(const ChangeSubscriptionBase&) = delete;
+    ChangeSubscriptionBase& operator=(const ChangeSubscriptionBase&) = delete;
+};
+}
+
+/**
+ * Notifies about the modifications of the values of a group of params, so that they need not be polled.
+ * Bit N of the changed-param mask corresponds to the Nth param of the group.
+ * The event source is broadcasted with the mask as the event flags every time the value of a param of the group
+ * is changed by configSet() or its counterparts, or reset by configErase(). Setting the same value again has
+ * no effect.
+ *
+ * Usage:
+ *      static os::config::ChangeSubscription subscription(param_gain, param_offset);
+ *      os::config::subscribe(subscription);
+ *
+ *      event_listener_t listener;
+ *      chEvtRegisterMaskWithFlags(&subscription.getEventSource(), &listener, EVENT_MASK(0), ALL_EVENTS);
+ *      ...
+ *      chEvtWaitAny(EVENT_MASK(0));
+ *      if (chEvtGetAndClearFlags(&listener) & subscription.getMask(param_gain))
+ *      {
+ *          gain = param_gain.get();
+ *      }
+ */
+template <std::size_t N>
+class ChangeSubscription : public _internal::ChangeSubscriptionBase
+{
+    static_assert((N > 0) && (N <= (sizeof(::eventflags_t) * 8U)), "The group doesn't fit into the event flags");
+
+    const std::array<const ::ConfigParam*, N> params_;
+    std::array<std::uint16_t, N> indexes_{};
+
+public:
+    template <typename... Ts>
+    explicit ChangeSubscription(const _internal::Param<Ts>&... arg_params) :
+        ChangeSubscriptionBase(params_.data(), indexes_.data(), std::uint8_t(N)),
+        params_{{ static_cast<const ::ConfigParam*>(&arg_params)... }}
+    { }
+
+    ::event_source_t& getEventSource() { return event_source; }
+
+    /**
+     * The callback is invoked with the changed-param mask, in addition to the broadcast.
+     * It is invoked from the thread that modifies the configuration, while the configuration is locked; therefore,
+     * it must be short, and it must not modify the configuration. It must be set before subscribing.
+     */
+    void setCallback(const Callback& cb) { callback = cb; }
+
+    ::eventflags_t getMask(const ::ConfigParam& param) const
+    {
+        for (std::size_t i = 0; i < N; i++)
+        {
+            if (params_[i] == &param)
+            {
+                return ::eventflags_t(1) << i;
+            }
+        }
+        return 0;
+    }
+};
+
+template <typename... Ts>
+ChangeSubscription(const _internal::Param<Ts>&...) -> ChangeSubscription<sizeof...(Ts)>;
+
+/**
+ * Activates the subscription; the subscription object must not be destroyed until it is unsubscribed.
+ * Can be used only after the config module is initialized.
+ */
+void subscribe(_internal::ChangeSubscriptionBase& subscription);
+void unsubscribe(_internal::ChangeSubscriptionBase& subscription);
+
 /**
  * Save configuration into the non-volatile memory.
- * @return Non-negative on success, negative errno on failure.
+ * Only the modified params are written if the journaled storage format is used; if no params were modified,
+ * this is a no-op.
+ * @return Number of modified params that were saved on success (possibly zero), negative errno on failure.
  */
 inline int save()
 {
     return ::configSave();
 }
 
+/**
+ * Same as @ref save(), but only the specified domain is saved; its modified params are no longer unsaved afterwards.
+ */
+int save(const Domain& domain);
+
+/**
+ * Starts the low priority background thread that serves @ref saveAsync(); this is optional.
+ * The thread is available only if CONFIG_ASYNC_SAVE_STACK_SIZE is defined non-zero, otherwise -ENOTSUP is returned.
+ * The thread saves the configuration once no new save requests were received during the quiet period, so that
+ * a burst of requests (e.g. from a parameter tuning session) results in one write. The save is performed anyway
+ * once the oldest pending request has been waiting for the maximum latency, so that frequent requests can't
+ * postpone it indefinitely; zero selects four quiet periods. The maximum latency can't be less than the quiet period.
+ * This function installs the reboot preparation hook (see os::requestReboot()), which makes sure that pending
+ * changes are saved before the reboot.
+ * @return Zero on success, negative errno on failure.
+ */
+int startAsyncSaveThread(::tprio_t priority, unsigned quiet_period_msec, unsigned max_latency_msec = 0);
+
+/**
+ * Requests the configuration to be saved by the background thread; never blocks.
+ * If the background thread is not running, the configuration is saved synchronously.
+ */
+void saveAsync();
+
+template <typename T>
+inline int _internal::Param<T>::setAndSaveAsync(const T& value) const
+{
+    const int res = set(value);
+    if (res >= 0)
+    {
+        saveAsync();
+    }
+    return res;
+}
+
+inline int _internal::Param<bool>::setAndSaveAsync(bool value) const
+{
+    const int res = set(value);
+    if (res >= 0)
+    {
+        saveAsync();
+    }
+    return res;
+}
+
+/**
+ * Makes the background thread save the pending changes immediately, skipping the quiet period; never blocks.
+ */
+void requestAsyncSaveFlush();
+
+/**
+ * Waits until the pending changes are saved by the background thread, skipping the quiet period.
+ * The calling thread waits on the event source of the background thread (see @ref getAsyncSaveEventSource()) using
+ * its own event 31 (EVENT_MASK(31)), so the caller must not use this event for anything else.
+ * @return Result of the last save (see @ref save()), or -ETIMEDOUT.
+ */
+int flushAsyncSave(unsigned timeout_msec);
+
+/**
+ * The event source is broadcasted every time a background save is completed.
+ */
+static constexpr ::eventflags_t AsyncSaveEventFlagSuccess = 1;
+static constexpr ::eventflags_t AsyncSaveEventFlagFailure = 2;
+
+::event_source_t& getAsyncSaveEventSource();
+
+/**
+ * Invokes IStorageBackend::prepareErase(); this should be done from a low priority thread after every save,
+ * unless the background save thread is running, which does that by itself.
+ * The setters are not blocked meanwhile, unlike the saves.
+ * @return Non-negative on success, negative errno on failure.
+ */
+int prepareStorage();
+
 /**
  * Erase the non-volatile memory and reset to factory defaults.
  * @return Non-negative on success, negative errno on failure.
@@ -188,6 +874,35 @@ inline int erase()
     return ::configErase();
 }
 
+/**
+ * Same as @ref erase(), but only the specified domain is erased and reset.
+ */
+int erase(const Domain& domain);
+
+/**
+ * The snapshot is a binary image of the values of all params, e.g. for transferring the configuration of a node
+ * over the shell or UAVCAN at once. It consists of the magic number that includes the version of the snapshot
+ * format, the hash of the configuration format (the names and the native types of the params), the CRC, and the
+ * values in their native representation. The size of the snapshot is constant after init().
+ * The snapshot can be imported only by a node that has the same set of params.
+ */
+std::size_t getSnapshotSize();
+
+/**
+ * Takes the snapshot of the values of all params under one lock, so that it is consistent.
+ * @return Size of the snapshot on success, -ENOSPC if the buffer is too small.
+ */
+int exportSnapshot(void* buffer, std::size_t size);
+
+/**
+ * Validates the snapshot, then sets the values of all params from it at once, like Transaction<>::commit().
+ * Either all params are set, or none.
+ * @return Zero, or the result of the save if requested; -EINVAL if the snapshot is malformed or contains
+ *         invalid values, -ENOENT if it was taken from a different set of params, -ENOSPC if the sparse storage
+ *         has no room for the values (see CONFIG_SPARSE_OVERRIDES_MAX).
+ */
+int importSnapshot(const void* buffer, std::size_t size, bool save = false);
+
 /**
  * Returns the name of the configuration parameter by index (zero-based).
  * Returns nullptr if the index exceeds the set of parameters.
@@ -199,8 +914,7 @@ inline const char* getNameOfParamAtIndex(std::uint16_t index)
 
 /**
  * This variant is used with the metadata accessor below. Otherwise it's mostly useless.
- * The underlying type is deduced via some clever magic tricks at runtime.
- * Observe that the parameters are ordered in the order of their value range, unsigned first.
+ * The underlying type is the native type the value of the param is stored as.
  */
 using ParamMetadataPointer = std::variant<
     Param<bool>*,
@@ -214,10 +928,61 @@ using ParamMetadataPointer = std::variant<
 /**
  * Returns typed pointer to the parameter metadata.
  * If name is a nullptr, or the name is not known, returns an empty option.
+ * Params defined via the C API macros, including the elements of the array params, are not Param<> instances, so a
+ * Param<> copy of the descriptor is made for them on the first request; an empty option is returned for such params
+ * once CONFIG_C_PARAM_METADATA_MAX copies are in use. The copy of an array element has the name of the element.
  * The fact that the function accepts nullptr allows one to use it with the index-based accessor as follows:
  *      out = getParamMetadata(getNameOfParamAtIndex(index))
  */
 std::optional<ParamMetadataPointer> getParamMetadata(const char* name);
 
+#if CONFIG_INSTRUMENTATION
+/**
+ * Counters of the accesses to a param since init() or the last reset; see instrumentation.hpp for the reporting.
+ * Every element of an array param has its own counters, except the lookups, which are counted for the first one.
+ */
+struct ParamAccessCounters
+{
+    std::uint32_t gets;
+    std::uint32_t sets;                     ///< Attempts, including those that did not change the value
+    std::uint32_t lookups;                  ///< Accesses by name, e.g. via configGet()
+};
+
+/**
+ * Durations are in system ticks.
+ */
+struct AccessStatistics
+{
+    static constexpr unsigned LookupCostHistogramSize = 8;
+
+    std::uint32_t locks;                    ///< Of the config mutex
+    std::uint32_t contended_locks;          ///< Those that had to wait
+    std::uint32_t lock_wait_total;
+    std::uint32_t lock_wait_max;
+
+    std::uint32_t saves;                    ///< Those that wrote anything
+    std::uint32_t save_duration_total;
+    std::uint32_t save_duration_max;
+    std::uint32_t erase_duration_total;     ///< Including the erases of the storage via erase()
+    std::uint32_t program_duration_total;
+
+    /// Number of name lookups by the number of name comparisons: 0..1, 2..3, 4..7, and so on; the last bucket is open
+    std::array<std::uint32_t, LookupCostHistogramSize> lookup_cost_histogram;
+};
+
+/**
+ * @param [in] index Non-negative parameter index
+ * @return Counters of the param, zeros if the index is out of range
+ */
+ParamAccessCounters getParamAccessCounters(std::uint16_t index);
+
+AccessStatistics getAccessStatistics();
+
+/**
+ * Zeroes all statistics; this is done by init() as well, so the registration of the params is not counted.
+ */
+void resetAccessStatistics();
+#endif
+
 }
 }
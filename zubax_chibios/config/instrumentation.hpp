@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) 2026 Zubax, zubax.com
+ * Distributed under the MIT License, available in the file LICENSE.
+ * Author: Pavel Kirienko <pavel.kirienko@zubax.com>
+ */
+
+/*
+ * Reporting of the access statistics of the config module, see CONFIG_INSTRUMENTATION.
+ * The statistics can be printed into the log:
+ *
+ *      os::config::logAccessStatistics(logger);
+ *
+ * Or via the shell command "cfgstat"; the command "cfgstat reset" zeroes the statistics:
+ *
+ *      static os::config::AccessStatisticsCommandHandler cfgstat_handler;
+ *      shell.addCommandHandler(&cfgstat_handler);
+ */
+
+#pragma once
+
+#include "config.hpp"
+
+#if CONFIG_INSTRUMENTATION
+
+#include <zubax_chibios/sys/sys.hpp>
+#include <zubax_chibios/util/shell.hpp>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+
+namespace os
+{
+namespace config
+{
+namespace _internal
+{
+
+inline unsigned long ticksToMicroseconds(std::uint32_t ticks)
+{
+    return static_cast<unsigned long>((std::uint64_t(ticks) * 1000000ULL) / CH_CFG_ST_FREQUENCY);
+}
+
+}
+
+/**
+ * Renders the statistics line by line; the sink is invoked as sink(const char* line), without the line terminator.
+ * Only the params that were accessed are listed.
+ */
+template <typename LineSink>
+void printAccessStatistics(LineSink sink)
+{
+    using _internal::ticksToMicroseconds;
+
+    const AccessStatistics st = getAccessStatistics();
+    char line[160];
+
+    std::snprintf(line, sizeof(line), "locks %u, contended %u, wait total %lu us, max %lu us",
+                  unsigned(st.locks), unsigned(st.contended_locks),
+                  ticksToMicroseconds(st.lock_wait_total), ticksToMicroseconds(st.lock_wait_max));
+    sink(static_cast<const char*>(line));
+
+    std::snprintf(line, sizeof(line), "saves %u, total %lu us, max %lu us; erase %lu us, program %lu us",
+                  unsigned(st.saves),
+                  ticksToMicroseconds(st.save_duration_total), ticksToMicroseconds(st.save_duration_max),
+                  ticksToMicroseconds(st.erase_duration_total), ticksToMicroseconds(st.program_duration_total));
+    sink(static_cast<const char*>(line));
+
+    int pos = std::snprintf(line, sizeof(line), "lookups by comparisons:");
+    for (unsigned i = 0; i < AccessStatistics::LookupCostHistogramSize; i++)
+    {
+        pos += std::snprintf(&line[pos], sizeof(line) - std::size_t(pos), " %s%u:%u",
+                             (i + 1U < AccessStatistics::LookupCostHistogramSize) ? "" : ">=",
+                             1U << i, unsigned(st.lookup_cost_histogram[i]));
+    }
+    sink(static_cast<const char*>(line));
+
+    const std::uint16_t num_params = getParamCount();
+    for (std::uint16_t index = 0; index < num_params; index++)
+    {
+        const ParamAccessCounters c = getParamAccessCounters(index);
+        if ((c.gets | c.sets | c.lookups) != 0)
+        {
+            std::snprintf(line, sizeof(line), "%4u %-40.80s get %8u set %8u lookup %8u", unsigned(index),
+                          configNameByIndex(index), unsigned(c.gets), unsigned(c.sets), unsigned(c.lookups));
+            sink(static_cast<const char*>(line));
+        }
+    }
+}
+
+inline void logAccessStatistics(os::Logger& logger)
+{
+    printAccessStatistics([&logger](const char* line) { logger.puts(line); });
+}
+
+class AccessStatisticsCommandHandler : public os::shell::ICommandHandler
+{
+    const char* getName() const override { return "cfgstat"; }
+
+    void execute(os::shell::BaseChannelWrapper& ios, int argc, char** argv) override
+    {
+        if ((argc > 1) && (std::strcmp(argv[1], "reset") == 0))
+        {
+            resetAccessStatistics();
+            ios.puts("OK");
+            return;
+        }
+        printAccessStatistics([&ios](const char* line) { ios.puts(line); });
+    }
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,181 @@
+/*
+ * Copyright (c) 2026 Zubax, zubax.com
+ * Distributed under the MIT License, available in the file LICENSE.
+ * Author: Pavel Kirienko <pavel.kirienko@zubax.com>
+ */
+
+/*
+ * Compile-time parameter registry.
+ *
+ * By default, the params are registered at the static initialization time, which costs RAM for the descriptor
+ * pool and O(N^2) time for the duplicate name checks. If the config module is built with CONFIG_STATIC_REGISTRY
+ * defined non-zero, the descriptor table, the name-sorted index, and the layout hashes are built by the compiler
+ * instead, and placed into ROM. Names are validated at compile time as well.
+ *
+ * The list of params is defined as an X-macro in a header:
+ *
+ *      #define APP_CONFIG_PARAMS(X)                                                    \
+ *          X(float, param_gain,    "ctl.gain",     1.0F,   0.0F,   10.0F)              \
+ *          X(int,   param_period,  "ctl.period",   10,     1,      100)                \
+ *          X(bool,  param_enabled, "ctl.enabled",  true,   false,  true)
+ *
+ *      CONFIG_STATIC_REGISTRY_DECLARE(APP_CONFIG_PARAMS)
+ *
+ * This defines the usual Param<> objects named as specified (param_gain etc.), that are used as usual.
+ * The domain of a param (see os::config::Domain) can be specified before the name, like in the Param<> constructor:
+ *
+ *          X(float, param_offset,  CalibrationDomain, "cal.offset", 0.0F, -1.0F, 1.0F)
+ *
+ * Then, exactly one source file must contain the following at the global namespace scope:
+ *
+ *      CONFIG_STATIC_REGISTRY_DEFINE()
+ *
+ * Params defined via the C macros or the Param<> constructors remain supported for compatibility, as long as
+ * the same name is also present in the static registry; they will refer to the same value.
+ * Array params (os::config::ParamArray<>) are not supported by the static registry.
+ */
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include "config.hpp"
+
+#ifndef CONFIG_PARAM_MAX_NAME_LENGTH
+#  define CONFIG_PARAM_MAX_NAME_LENGTH     92    // UAVCAN compliant
+#endif
+
+#ifndef CONFIG_DOMAINS_MAX
+#  define CONFIG_DOMAINS_MAX    1
+#endif
+
+
+namespace os
+{
+namespace config
+{
+/**
+ * Representation of the registry that is used by the config module.
+ */
+struct StaticRegistryView
+{
+    const ::ConfigParam* const* params;         ///< Ordered by index
+    const std::uint16_t* sorted_index;          ///< Param indexes ordered by name
+    std::uint16_t num_params;
+    const std::uint32_t* layout_hashes;         ///< Per domain
+};
+
+namespace _internal
+{
+constexpr int compareNames(const char* a, const char* b)
+{
+    while ((*a != '\0') && (*a == *b))
+    {
+        a++;
+        b++;
+    }
+    return int(static_cast<unsigned char>(*a)) - int(static_cast<unsigned char>(*b));
+}
+
+/**
+ * This function is not constexpr, so calling it from a constant expression stops the compilation.
+ * The name of the function will be shown in the compiler error message.
+ */
+inline void staticRegistryIsInvalidCheckParamNamesAndValues() { }
+
+template <std::size_t N>
+class StaticRegistry
+{
+    std::array<const ::ConfigParam*, N> params_{};
+    std::array<std::uint16_t, N> sorted_index_{};
+    std::array<std::uint32_t, CONFIG_DOMAINS_MAX> layout_hashes_{};
+
+public:
+    constexpr explicit StaticRegistry(const std::array<const ::ConfigParam*, N>& params) :
+        params_(params)
+    {
+        static_assert(N <= 0xFFFFU, "Too many params");
+
+        for (std::size_t i = 0; i < N; i++)
+        {
+            const ::ConfigParam& p = *params_[i];
+            if ((p.domain >= CONFIG_DOMAINS_MAX) || (p.length != 0))
+            {
+                staticRegistryIsInvalidCheckParamNamesAndValues();
+            }
+
+            // Same hash as computed by the runtime registration, so the layouts are compatible
+            std::uint32_t& layout_hash = layout_hashes_[p.domain % CONFIG_DOMAINS_MAX];
+            std::size_t name_length = 0;
+            for (const char* c = p.name; *c; c++)
+            {
+                layout_hash = crc32Step(layout_hash, std::uint8_t(*c));
+                name_length++;
+            }
+
+            if ((name_length == 0) ||
+                (name_length > CONFIG_PARAM_MAX_NAME_LENGTH) ||
+                !(p.min <= p.default_) ||
+                !(p.default_ <= p.max) ||
+                ((p.type == CONFIG_TYPE_INT) && !isWithinIntegerStorageRange(p.storage, double(p.default_))))
+            {
+                staticRegistryIsInvalidCheckParamNamesAndValues();
+            }
+
+            // Insertion sort by name; the number of params is small, and this is done only once by the compiler
+            std::size_t k = i;
+            while ((k > 0) && (compareNames(params_[sorted_index_[k - 1]]->name, p.name) > 0))
+            {
+                sorted_index_[k] = sorted_index_[k - 1];
+                k--;
+            }
+            sorted_index_[k] = std::uint16_t(i);
+        }
+
+        for (std::size_t i = 1; i < N; i++)
+        {
+            if (compareNames(params_[sorted_index_[i - 1]]->name, params_[sorted_index_[i]]->name) == 0)
+            {
+                staticRegistryIsInvalidCheckParamNamesAndValues();      // Names are not unique
+            }
+        }
+    }
+
+    constexpr StaticRegistryView getView() const
+    {
+        return { params_.data(), sorted_index_.data(), std::uint16_t(N), layout_hashes_.data() };
+    }
+};
+
+} // namespace _internal
+} // namespace config
+} // namespace os
+
+/*
+ * Implementation details of the macros below.
+ */
+#define CONFIG_STATIC_REGISTRY_INDEX_(type, ident, ...)    ident,
+
+#define CONFIG_STATIC_REGISTRY_PARAM_(type, ident, ...)                                                     \
+    inline constexpr ::os::config::Param<type> ident{                                                       \
+        ::os::config::_internal::StaticIndex{ int(ConfigStaticRegistryIndex_::ident) }, __VA_ARGS__ };
+
+#define CONFIG_STATIC_REGISTRY_POINTER_(type, ident, ...)  static_cast<const ::ConfigParam*>(&ident),
+
+/**
+ * Defines the params and the registry. See the usage example above.
+ */
+#define CONFIG_STATIC_REGISTRY_DECLARE(list)                                                                \
+    enum class ConfigStaticRegistryIndex_ { list(CONFIG_STATIC_REGISTRY_INDEX_) NumParams_ };               \
+    list(CONFIG_STATIC_REGISTRY_PARAM_)                                                                     \
+    inline constexpr ::os::config::_internal::StaticRegistry<                                              \
+        std::size_t(ConfigStaticRegistryIndex_::NumParams_)> ConfigStaticRegistry_{                         \
+            std::array<const ::ConfigParam*, std::size_t(ConfigStaticRegistryIndex_::NumParams_)>{{         \
+                list(CONFIG_STATIC_REGISTRY_POINTER_) }} };
+
+/**
+ * Makes the registry available to the config module. See the usage example above.
+ */
+#define CONFIG_STATIC_REGISTRY_DEFINE()                                                                     \
+    extern const ::os::config::StaticRegistryView _config_static_registry;                                  \
+    const ::os::config::StaticRegistryView _config_static_registry = ConfigStaticRegistry_.getView();
@@ -0,0 +1,428 @@
+/*
+ * Copyright (c) 2026 Zubax, zubax.com
+ * Distributed under the MIT License, available in the file LICENSE.
+ * Author: Pavel Kirienko <pavel.kirienko@zubax.com>
+ */
+
+/*
+ * Model of a NOR flash for running the storage code on the host, e.g. for benchmarking the config storage strategies
+ * or the firmware upgrade, or for wear leveling simulations. It depends on the standard library only.
+ *
+ * The model enforces the NOR flash constraints: programming can only clear bits, and the memory can only be erased
+ * by whole erase units (pages or sectors). It counts the erase cycles of every unit, accumulates the simulated
+ * time of the operations according to the configured latencies, and it can simulate a power loss in the middle
+ * of an operation. The memory is held in RAM and can be accessed directly, like memory-mapped flash.
+ * SimulatedFlashWriter provides the interface of FlashWriter on top of it.
+ *
+ *      os::host::NorFlashSimulator flash({ { 16 * 1024, 4 }, { 64 * 1024, 1 }, { 128 * 1024, 3 } });
+ *      os::host::SimulatedConfigStorageBackend storage(flash, 0, 32 * 1024);     // See storage_backends.hpp
+ *      os::config::init(&storage);
+ */
+
+#pragma once
+
+#include <vector>
+#include <random>
+#include <chrono>
+#include <thread>
+#include <cerrno>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+
+
+namespace os
+{
+namespace host
+{
+
+/**
+ * A contiguous run of erase units of the same size; the regions follow each other from offset zero.
+ */
+struct NorFlashRegion
+{
+    std::size_t unit_size;
+    unsigned num_units;
+};
+
+/**
+ * The size is zero if there is no such unit.
+ */
+struct NorFlashEraseUnit
+{
+    std::size_t offset = 0;
+    std::size_t size = 0;
+    unsigned index = 0;
+
+    bool isValid() const { return size > 0; }
+};
+
+/**
+ * The latencies are accumulated in the simulated time; the calling thread is also delayed by them
+ * if real_time is set.
+ */
+struct NorFlashTiming
+{
+    std::uint32_t program_ns = 0;           ///< Per program unit
+    std::uint32_t erase_ns = 0;             ///< Per erase unit
+    bool real_time = false;
+};
+
+struct NorFlashStatistics
+{
+    std::uint64_t bytes_read = 0;
+    std::uint64_t bytes_programmed = 0;
+    std::uint64_t program_units = 0;
+    std::uint64_t erase_units = 0;
+    std::uint64_t errors = 0;
+    std::uint64_t power_losses = 0;
+    std::uint64_t elapsed_ns = 0;
+};
+
+class NorFlashSimulator
+{
+public:
+    using Region = NorFlashRegion;
+    using EraseUnit = NorFlashEraseUnit;
+    using Timing = NorFlashTiming;
+    using Statistics = NorFlashStatistics;
+
+private:
+    static constexpr std::uint8_t ErasedByte = 0xFF;
+
+    std::vector<Region> geometry_;
+    std::vector<std::uint8_t> memory_;
+    std::vector<std::uint32_t> erase_counts_;
+    const unsigned program_unit_;
+    Timing timing_;
+    std::uint32_t endurance_ = 0;
+    Statistics stats_;
+
+    std::uint64_t operations_until_power_loss_ = 0;
+    bool power_loss_scheduled_ = false;
+    bool powered_down_ = false;
+    std::minstd_rand random_;
+
+    void spend(const std::uint32_t ns)
+    {
+        stats_.elapsed_ns += ns;
+        if (timing_.real_time && (ns > 0))
+        {
+            std::this_thread::sleep_for(std::chrono::nanoseconds(ns));
+        }
+    }
+
+    /**
+     * Returns true if the current operation is interrupted by the scheduled power loss.
+     */
+    bool checkPowerLoss()
+    {
+        if (power_loss_scheduled_)
+        {
+            if (operations_until_power_loss_ == 0)
+            {
+                power_loss_scheduled_ = false;
+                powered_down_ = true;
+                stats_.power_losses++;
+                return true;
+            }
+            operations_until_power_loss_--;
+        }
+        return false;
+    }
+
+    int fail(const int error)
+    {
+        stats_.errors++;
+        return error;
+    }
+
+    bool isRangeValid(const std::size_t offset, const std::size_t len) const
+    {
+        return (offset <= memory_.size()) && (len <= (memory_.size() - offset));
+    }
+
+public:
+    /**
+     * The program unit is the smallest amount of memory that can be programmed, e.g. 2 bytes on STM32F1.
+     * The program operations must be aligned at it; a partial unit at the end is padded with the erased value.
+     * The initial content is erased.
+     */
+    explicit NorFlashSimulator(const std::vector<Region>& geometry,
+                               const unsigned program_unit = 2,
+                               const Timing& timing = Timing(),
+                               const unsigned random_seed = 1) :
+        geometry_(geometry),
+        program_unit_(std::max(program_unit, 1U)),
+        timing_(timing),
+        random_(random_seed)
+    {
+        std::size_t size = 0;
+        unsigned num_units = 0;
+        for (const Region& r : geometry_)
+        {
+            size += r.unit_size * r.num_units;
+            num_units += r.num_units;
+        }
+        memory_.resize(size, ErasedByte);
+        erase_counts_.resize(num_units, 0);
+    }
+
+    std::size_t getSize() const { return memory_.size(); }
+
+    /**
+     * The memory can be read directly, like memory-mapped flash; it must not be modified bypassing the simulator.
+     */
+    const std::uint8_t* getData() const { return memory_.data(); }
+    std::uint8_t* getData() { return memory_.data(); }
+
+    EraseUnit getEraseUnitContaining(const std::size_t offset) const
+    {
+        std::size_t base = 0;
+        unsigned index = 0;
+        for (const Region& r : geometry_)
+        {
+            const std::size_t end = base + r.unit_size * r.num_units;
+            if (offset < end)
+            {
+                const unsigned local_index = unsigned((offset - base) / r.unit_size);
+                EraseUnit unit;
+                unit.offset = base + r.unit_size * local_index;
+                unit.size = r.unit_size;
+                unit.index = index + local_index;
+                return unit;
+            }
+            base = end;
+            index += r.num_units;
+        }
+        return EraseUnit();
+    }
+
+    EraseUnit getEraseUnit(const unsigned index) const
+    {
+        std::size_t base = 0;
+        unsigned first_index = 0;
+        for (const Region& r : geometry_)
+        {
+            if (index < (first_index + r.num_units))
+            {
+                EraseUnit unit;
+                unit.offset = base + r.unit_size * (index - first_index);
+                unit.size = r.unit_size;
+                unit.index = index;
+                return unit;
+            }
+            base += r.unit_size * r.num_units;
+            first_index += r.num_units;
+        }
+        return EraseUnit();
+    }
+
+    unsigned getEraseUnitCount() const { return unsigned(erase_counts_.size()); }
+
+    std::uint32_t getEraseCount(const unsigned unit_index) const
+    {
+        return (unit_index < erase_counts_.size()) ? erase_counts_[unit_index] : 0;
+    }
+
+    std::uint32_t getMaxEraseCount() const
+    {
+        return erase_counts_.empty() ? 0 : *std::max_element(erase_counts_.begin(), erase_counts_.end());
+    }
+
+    /**
+     * Once a unit has been erased this many times, its further erase operations leave some bits programmed,
+     * like a worn out flash does; zero means unlimited.
+     */
+    void setEndurance(const std::uint32_t erase_cycles) { endurance_ = erase_cycles; }
+
+    void setTiming(const Timing& timing) { timing_ = timing; }
+
+    const Statistics& getStatistics() const { return stats_; }
+    void resetStatistics() { stats_ = Statistics(); }
+
+    /**
+     * The specified number of program or erase unit operations will complete, and the next one will be interrupted
+     * by a power loss, leaving the unit in an undefined state. After that all operations fail with -EIO
+     * until powerCycle() is called.
+     */
+    void schedulePowerLoss(const std::uint64_t operations_to_complete)
+    {
+        operations_until_power_loss_ = operations_to_complete;
+        power_loss_scheduled_ = true;
+    }
+
+    void cancelPowerLoss() { power_loss_scheduled_ = false; }
+
+    bool isPoweredDown() const { return powered_down_; }
+
+    /**
+     * Restores the power; the content of the memory is retained.
+     */
+    void powerCycle() { powered_down_ = false; }
+
+    /**
+     * @return Zero on success, negative errno on failure.
+     */
+    int read(const std::size_t offset, void* const data, const std::size_t len)
+    {
+        if ((data == nullptr) || !isRangeValid(offset, len))
+        {
+            return fail(-EINVAL);
+        }
+        if (powered_down_)
+        {
+            return fail(-EIO);
+        }
+        std::memcpy(data, &memory_[offset], len);
+        stats_.bytes_read += len;
+        return 0;
+    }
+
+    /**
+     * Programs the data unit by unit; a bit can only be changed from one to zero, so the memory is expected to be
+     * erased. An attempt to set a programmed bit to one leaves it programmed and fails with -EIO, but the operation
+     * is completed nevertheless, like in the real hardware.
+     * @return Zero on success, negative errno on failure.
+     */
+    int program(const std::size_t offset, const void* const data, const std::size_t len)
+    {
+        if ((data == nullptr) || !isRangeValid(offset, len) || ((offset % program_unit_) != 0))
+        {
+            return fail(-EINVAL);
+        }
+        if (powered_down_)
+        {
+            return fail(-EIO);
+        }
+
+        const std::uint8_t* const source = static_cast<const std::uint8_t*>(data);
+        bool mismatch = false;
+        for (std::size_t pos = 0; pos < len; pos += program_unit_)
+        {
+            const std::size_t unit_len = std::min<std::size_t>(program_unit_, memory_.size() - (offset + pos));
+            if (checkPowerLoss())
+            {
+                for (std::size_t i = 0; i < unit_len; i++)      // Some of the bits are programmed
+                {
+                    const std::uint8_t value = (pos + i < len) ? source[pos + i] : ErasedByte;
+                    memory_[offset + pos + i] &= std::uint8_t(value | std::uint8_t(random_()));
+                }
+                return fail(-EIO);
+            }
+
+            for (std::size_t i = 0; i < unit_len; i++)
+            {
+                const std::uint8_t value = (pos + i < len) ? source[pos + i] : ErasedByte;
+                std::uint8_t& cell = memory_[offset + pos + i];
+                mismatch = mismatch || ((cell & value) != value);
+                cell &= value;
+            }
+            stats_.program_units++;
+            spend(timing_.program_ns);
+        }
+        stats_.bytes_programmed += len;
+
+        return mismatch ? fail(-EIO) : 0;
+    }
+
+    /**
+     * Erases the unit; fails with -EIO if the unit is worn out, see setEndurance().
+     * @return Zero on success, negative errno on failure.
+     */
+    int eraseUnit(const unsigned unit_index)
+    {
+        const EraseUnit unit = getEraseUnit(unit_index);
+        if (!unit.isValid())
+        {
+            return fail(-EINVAL);
+        }
+        if (powered_down_)
+        {
+            return fail(-EIO);
+        }
+
+        std::uint8_t* const begin = &memory_[unit.offset];
+
+        if (checkPowerLoss())
+        {
+            for (std::size_t i = 0; i < unit.size; i++)         // Some of the bits are erased
+            {
+                begin[i] |= std::uint8_t(random_());
+            }
+            return fail(-EIO);
+        }
+
+        std::fill(begin, begin + unit.size, ErasedByte);
+        erase_counts_[unit_index]++;
+        stats_.erase_units++;
+        spend(timing_.erase_ns);
+
+        if ((endurance_ > 0) && (erase_counts_[unit_index] > endurance_))
+        {
+            begin[random_() % unit.size] &= std::uint8_t(~(1U << (random_() % 8U)));
+            return fail(-EIO);
+        }
+        return 0;
+    }
+
+    /**
+     * Erases every unit that overlaps with the specified range.
+     * @return Zero on success, negative errno on failure.
+     */
+    int erase(const std::size_t offset, const std::size_t len)
+    {
+        if (!isRangeValid(offset, len))
+        {
+            return fail(-EINVAL);
+        }
+        for (std::size_t pos = offset; pos < (offset + len);)
+        {
+            const EraseUnit unit = getEraseUnitContaining(pos);
+            const int res = eraseUnit(unit.index);
+            if (res < 0)
+            {
+                return res;
+            }
+            pos = unit.offset + unit.size;
+        }
+        return 0;
+    }
+};
+
+/**
+ * The same interface and semantics as os::stm32::FlashWriter, in terms of the addresses within the memory
+ * of the simulator; unlike on the target, the overlapping erase units are erased unconditionally.
+ */
+class SimulatedFlashWriter
+{
+    NorFlashSimulator& flash_;
+
+    std::size_t getOffset(const void* const address) const
+    {
+        return std::size_t(static_cast<const std::uint8_t*>(address) - flash_.getData());
+    }
+
+public:
+    explicit SimulatedFlashWriter(NorFlashSimulator& flash) : flash_(flash) { }
+
+    bool write(const void* const where, const void* const what, const std::size_t how_much)
+    {
+        return (flash_.program(getOffset(where), what, how_much) == 0) &&
+               (std::memcmp(where, what, how_much) == 0);
+    }
+
+    bool erase(const void* const where, const std::size_t how_much)
+    {
+        if (flash_.erase(getOffset(where), how_much) < 0)
+        {
+            return false;
+        }
+        const std::uint8_t* const begin = static_cast<const std::uint8_t*>(where);
+        return std::all_of(begin, begin + how_much, [](std::uint8_t x) { return x == 0xFF; });
+    }
+};
+
+}
+}
@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) 2026 Zubax, zubax.com
+ * Distributed under the MIT License, available in the file LICENSE.
+ * Author: Pavel Kirienko <pavel.kirienko@zubax.com>
+ */
+
+/*
+ * Storage backends on top of the NOR flash simulator, the host counterparts of platform/stm32/config_storage.hpp
+ * and of the application storage of the bootloader. Each backend occupies a range of the simulated flash;
+ * the ranges should be aligned at the erase units, like on the target.
+ */
+
+#pragma once
+
+#include "nor_flash_simulator.hpp"
+#include <zubax_chibios/config/config.hpp>
+#include <zubax_chibios/bootloader/bootloader.hpp>
+#include <cassert>
+#include <cerrno>
+
+
+namespace os
+{
+namespace host
+{
+/**
+ * See os::config::IStorageBackend and os::stm32::ConfigStorageBackend.
+ */
+class SimulatedConfigStorageBackend : public os::config::IStorageBackend
+{
+    NorFlashSimulator& flash_;
+    const std::size_t offset_;
+    const std::size_t size_;
+
+public:
+    SimulatedConfigStorageBackend(NorFlashSimulator& flash,
+                                  std::size_t offset,
+                                  std::size_t size) :
+        flash_(flash),
+        offset_(offset),
+        size_(size)
+    {
+        assert((offset_ + size_) <= flash_.getSize());
+        assert(size_ > 0);
+    }
+
+    int read(std::size_t offset, void* data, std::size_t len) override
+    {
+        if ((data == nullptr) ||
+            (offset + len) > size_)
+        {
+            assert(false);
+            return -EINVAL;
+        }
+        return flash_.read(offset_ + offset, data, len);
+    }
+
+    const void* map(std::size_t offset, std::size_t len) override
+    {
+        return ((offset + len) <= size_) ? (flash_.getData() + offset_ + offset) : nullptr;
+    }
+
+    int write(std::size_t offset, const void* data, std::size_t len) override
+    {
+        if ((data == nullptr) ||
+            (offset + len) > size_)
+        {
+            assert(false);
+            return -EINVAL;
+        }
+        return flash_.program(offset_ + offset, data, len);
+    }
+
+    int erase() override
+    {
+        return flash_.erase(offset_, size_);
+    }
+
+    std::size_t getSize() const override { return size_; }
+};
+
+/**
+ * See os::bootloader::IAppStorageBackend. The storage is erased entirely when the upgrade begins.
+ */
+class SimulatedAppStorageBackend : public os::bootloader::IAppStorageBackend
+{
+    NorFlashSimulator& flash_;
+    const std::size_t offset_;
+    const std::size_t size_;
+
+public:
+    SimulatedAppStorageBackend(NorFlashSimulator& flash,
+                               std::size_t offset,
+                               std::size_t size) :
+        flash_(flash),
+        offset_(offset),
+        size_(size)
+    {
+        assert((offset_ + size_) <= flash_.getSize());
+        assert(size_ > 0);
+    }
+
+    int beginUpgrade() override
+    {
+        return flash_.erase(offset_, size_);
+    }
+
+    int write(std::size_t offset, const void* data, std::size_t size) override
+    {
+        if ((offset + size) > size_)
+        {
+            return -EINVAL;
+        }
+        const int res = flash_.program(offset_ + offset, data, size);
+        return (res < 0) ? res : int(size);
+    }
+
+    int endUpgrade(bool success) override
+    {
+        (void)success;
+        return flash_.isPoweredDown() ? -EIO : 0;
+    }
+
+    int read(std::size_t offset, void* data, std::size_t size) const override
+    {
+        if (offset >= size_)
+        {
+            return 0;
+        }
+        size = std::min(size, size_ - offset);
+        const int res = flash_.read(offset_ + offset, data, size);
+        return (res < 0) ? res : int(size);
+    }
+};
+
+}
+}
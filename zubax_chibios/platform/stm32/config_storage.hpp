@@ -6,7 +6,8 @@
 
 #pragma once
 
-#include "flash_writer.hpp"
+#include "flash_engine.hpp"
+#include "flash_geometry.hpp"
 #include <zubax_chibios/config/config.hpp>
 #include <cstdint>
 #include <cassert>
@@ -20,6 +21,8 @@ namespace stm32
 {
 /**
  * See os::config::IStorageBackend.
+ * The flash is accessed via the flash engine (see flash_engine.hpp), which executes the operations synchronously
+ * unless the engine thread is running.
  */
 class ConfigStorageBackend : public os::config::IStorageBackend
 {
@@ -36,6 +39,7 @@ public:
         assert(size_    % 256 == 0);
         assert(address_ > 0);
         assert(size_    > 0);
+        assert(isFlashRegionEraseAligned(address_, size_));
     }
 
     int read(std::size_t offset, void* data, std::size_t len) override
@@ -51,6 +55,11 @@ public:
         return 0;
     }
 
+    const void* map(std::size_t offset, std::size_t len) override
+    {
+        return ((offset + len) <= size_) ? reinterpret_cast<const void*>(address_ + offset) : nullptr;
+    }
+
     int write(std::size_t offset, const void* data, std::size_t len) override
     {
         if ((data == nullptr) ||
@@ -60,13 +69,170 @@ public:
             return -EINVAL;
         }
 
-        return FlashWriter().write(reinterpret_cast<void*>(address_ + offset), data, len) ? 0 : -EIO;
+        return programFlash(reinterpret_cast<void*>(address_ + offset), data, len);
+    }
+
+    int erase() override
+    {
+        return eraseFlash(reinterpret_cast<void*>(address_), size_);
+    }
+
+    std::size_t getSize() const override { return size_; }
+};
+
+/**
+ * Keeps two copies of the configuration in two flash regions (slots), so that a save only programs the standby slot
+ * that was erased in advance, and an interrupted save leaves the previous copy intact.
+ * The header of the slot holds the sequence number, it is written by commit() after the data; the newest slot
+ * with a valid header is selected at construction.
+ * See os::config::prepareStorage() - if the standby slot was not erased in advance, it is erased by erase().
+ */
+class DualSlotConfigStorageBackend : public os::config::IStorageBackend
+{
+    struct SlotHeader
+    {
+        std::uint32_t sequence;
+        std::uint32_t sequence_inverted;
+
+        bool isValid() const { return sequence_inverted == ~sequence; }
+    };
+    static_assert(sizeof(SlotHeader) == 8, "Invalid slot header layout");
+
+    const std::size_t addresses_[2];
+    const std::size_t slot_size_;
+
+    unsigned active_ = 0;
+    std::uint32_t sequence_ = 0;        ///< Of the active slot, or of the one that will be committed
+    bool committed_ = false;            ///< The active slot holds a valid header
+    bool standby_erased_ = false;
+
+    const SlotHeader& getHeader(unsigned slot) const
+    {
+        return *reinterpret_cast<const SlotHeader*>(addresses_[slot]);
+    }
+
+    void* getDataAddress(std::size_t offset) const
+    {
+        return reinterpret_cast<void*>(addresses_[active_] + sizeof(SlotHeader) + offset);
+    }
+
+    bool eraseSlot(unsigned slot)
+    {
+        return eraseFlash(reinterpret_cast<void*>(addresses_[slot]), slot_size_) == 0;
+    }
+
+public:
+    DualSlotConfigStorageBackend(void* slot_a_address,
+                                 void* slot_b_address,
+                                 std::size_t slot_size) :
+        addresses_{ reinterpret_cast<std::size_t>(slot_a_address), reinterpret_cast<std::size_t>(slot_b_address) },
+        slot_size_(slot_size)
+    {
+        assert(addresses_[0] % 256 == 0);
+        assert(addresses_[1] % 256 == 0);
+        assert(slot_size_    % 256 == 0);
+        assert(addresses_[0] > 0);
+        assert(addresses_[1] > 0);
+        assert(slot_size_    > sizeof(SlotHeader));
+        assert(isFlashRegionEraseAligned(addresses_[0], slot_size_));
+        assert(isFlashRegionEraseAligned(addresses_[1], slot_size_));
+
+        const SlotHeader& a = getHeader(0);
+        const SlotHeader& b = getHeader(1);
+        if (a.isValid() || b.isValid())
+        {
+            // The sequence number may overflow, hence the signed difference
+            active_ = (a.isValid() && (!b.isValid() || (std::int32_t(a.sequence - b.sequence) > 0))) ? 0 : 1;
+            sequence_ = getHeader(active_).sequence;
+            committed_ = true;
+        }
+    }
+
+    int read(std::size_t offset, void* data, std::size_t len) override
+    {
+        if ((data == nullptr) ||
+            (offset + len) > getSize())
+        {
+            assert(false);
+            return -EINVAL;
+        }
+
+        std::memcpy(data, getDataAddress(offset), len);
+        return 0;
+    }
+
+    const void* map(std::size_t offset, std::size_t len) override
+    {
+        return ((offset + len) <= getSize()) ? getDataAddress(offset) : nullptr;
+    }
+
+    int write(std::size_t offset, const void* data, std::size_t len) override
+    {
+        if ((data == nullptr) ||
+            (offset + len) > getSize())
+        {
+            assert(false);
+            return -EINVAL;
+        }
+
+        return programFlash(getDataAddress(offset), data, len);
     }
 
+    /**
+     * Switches to the standby slot, unless the active one was not committed yet (e.g. a save is being retried);
+     * the uncommitted slot can be erased in place because the previous copy is in the other slot.
+     */
     int erase() override
     {
-        return FlashWriter().erase(reinterpret_cast<void*>(address_), size_) ? 0 : -EIO;
+        if (!committed_)
+        {
+            return eraseSlot(active_) ? 0 : -EIO;
+        }
+
+        const unsigned standby = active_ ^ 1U;
+        if (!standby_erased_ && !eraseSlot(standby))
+        {
+            return -EIO;
+        }
+
+        active_ = standby;
+        sequence_++;
+        committed_ = false;
+        standby_erased_ = false;
+        return 0;
+    }
+
+    int commit() override
+    {
+        if (committed_)
+        {
+            return 0;
+        }
+
+        const SlotHeader header{ sequence_, ~sequence_ };
+        const int res = programFlash(reinterpret_cast<void*>(addresses_[active_]), &header, sizeof(header));
+        if (res < 0)
+        {
+            return res;
+        }
+        committed_ = true;
+        return 0;
+    }
+
+    int prepareErase() override
+    {
+        if (committed_ && !standby_erased_)
+        {
+            if (!eraseSlot(active_ ^ 1U))
+            {
+                return -EIO;
+            }
+            standby_erased_ = true;
+        }
+        return 0;
     }
+
+    std::size_t getSize() const override { return slot_size_ - sizeof(SlotHeader); }
 };
 
 }
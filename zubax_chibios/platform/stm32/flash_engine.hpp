@@ -0,0 +1,189 @@
+/*
+ * Copyright (c) 2026 Zubax, zubax.com
+ * Distributed under the MIT License, available in the file LICENSE.
+ * Author: Pavel Kirienko <pavel.kirienko@zubax.com>
+ */
+
+/*
+ * Asynchronous flash engine: a thread that executes the queued program and erase requests using FlashWriter.
+ * While a page or sector is being erased, the thread sleeps until the FLASH interrupt (end of operation or error)
+ * wakes it up, so neither the engine nor the submitting threads burn CPU meanwhile.
+ *
+ * The engine is built only if FLASH_ENGINE_STACK_SIZE is defined non-zero, which requires
+ * FLASH_WRITER_BOUNDED_LATENCY; otherwise, or until the engine is started, the requests are executed synchronously
+ * by the submitting thread. All requests are serialized by a mutex, whether they are executed by the engine or
+ * synchronously, so the engine can be started while another thread is executing a request. The flash operations
+ * that bypass this API are not serialized.
+ *
+ * The completion of a request is signaled via a binary semaphore, which does not provide priority inheritance:
+ * a thread waiting for a request of the engine of a lower priority can be delayed by the threads of the intermediate
+ * priorities. Therefore, executeFlashRequest() executes the request in the calling thread if its priority is higher
+ * than that of the engine; see below. The threads that use submitFlashRequest() and FlashRequest::wait() directly
+ * should not have a higher priority than the engine.
+ *
+ * Usage, e.g. programming the firmware while the next chunk is being received:
+ *
+ *      os::stm32::startFlashEngine(LOWPRIO);
+ *      ...
+ *      static os::stm32::FlashRequest request;
+ *      if (request.wait() < 0)                 // Result of the previous chunk
+ *      {
+ *          ...
+ *      }
+ *      std::memcpy(buffer, chunk, chunk_size); // The buffer must stay intact until the request is completed
+ *      request.setProgram(destination, buffer, chunk_size);
+ *      os::stm32::submitFlashRequest(request);
+ */
+
+#pragma once
+
+#include <ch.hpp>
+#include <cassert>
+#include <cerrno>
+#include <cstdint>
+#include <cstddef>
+
+
+namespace os
+{
+namespace stm32
+{
+namespace _internal
+{
+struct FlashEngine;
+}
+
+/**
+ * A program or erase operation. The object and the data to program are owned by the caller; they must stay valid
+ * until the request is completed.
+ */
+class FlashRequest
+{
+    friend struct _internal::FlashEngine;
+
+public:
+    enum class Operation : std::uint8_t
+    {
+        Program,
+        Erase
+    };
+
+private:
+    FlashRequest* next_ = nullptr;
+    Operation operation_ = Operation::Program;
+    volatile bool pending_ = false;
+    void* where_ = nullptr;
+    const void* what_ = nullptr;
+    std::size_t size_ = 0;
+    volatile int result_ = 0;
+    ::binary_semaphore_t completion_;
+
+public:
+    FlashRequest()
+    {
+        chBSemObjectInit(&completion_, true);
+    }
+
+    ~FlashRequest()
+    {
+        assert(!pending_);
+    }
+
+    FlashRequest(const FlashRequest&) = delete;
+    FlashRequest& operator=(const FlashRequest&) = delete;
+
+    /**
+     * See FlashWriter::write(). The request must not be pending.
+     */
+    void setProgram(void* where, const void* what, std::size_t size)
+    {
+        assert(!pending_);
+        operation_ = Operation::Program;
+        where_ = where;
+        what_ = what;
+        size_ = size;
+    }
+
+    /**
+     * See FlashWriter::erase(). The request must not be pending.
+     */
+    void setErase(void* where, std::size_t size)
+    {
+        assert(!pending_);
+        operation_ = Operation::Erase;
+        where_ = where;
+        what_ = nullptr;
+        size_ = size;
+    }
+
+    Operation getOperation() const { return operation_; }
+
+    bool isPending() const { return pending_; }
+
+    /**
+     * Returns immediately if the request is not pending, e.g. if it was never submitted.
+     * There is no priority inheritance, see above.
+     * @return Result of the last completed operation: zero on success, -EIO on failure; or -ETIMEDOUT.
+     */
+    int wait(::sysinterval_t timeout = TIME_INFINITE)
+    {
+        if (pending_ && (chBSemWaitTimeout(&completion_, timeout) != MSG_OK))
+        {
+            return -ETIMEDOUT;
+        }
+        return result_;
+    }
+};
+
+/**
+ * Starts the engine thread; this is optional, see above.
+ * The thread is available only if FLASH_ENGINE_STACK_SIZE is defined non-zero, otherwise -ENOTSUP is returned.
+ * @return Zero on success, negative errno on failure.
+ */
+int startFlashEngine(::tprio_t priority);
+
+/**
+ * Queues the request and returns immediately; the requests are executed in the order of submission.
+ * If the engine is not running, the request is executed before returning.
+ * The request must not be pending.
+ */
+void submitFlashRequest(FlashRequest& request);
+
+/**
+ * Submits the request and waits for its completion.
+ * If the calling thread has a higher priority than the engine, it executes the queued requests and then its own
+ * request by itself rather than waiting for the engine; the order of execution is the same. If the engine is busy
+ * with a request meanwhile, it inherits the priority of the caller until the request is completed.
+ * The request must not be pending.
+ * @return Zero on success, -EIO on failure.
+ */
+int executeFlashRequest(FlashRequest& request);
+
+/**
+ * Synchronous operations via the engine, see FlashWriter.
+ * @return Zero on success, -EIO on failure.
+ */
+inline int programFlash(void* where, const void* what, std::size_t size)
+{
+    FlashRequest request;
+    request.setProgram(where, what, size);
+    return executeFlashRequest(request);
+}
+
+inline int eraseFlash(void* where, std::size_t size)
+{
+    FlashRequest request;
+    request.setErase(where, size);
+    return executeFlashRequest(request);
+}
+
+/**
+ * The event source is broadcasted every time a request is completed.
+ */
+static constexpr ::eventflags_t FlashEngineEventFlagSuccess = 1;
+static constexpr ::eventflags_t FlashEngineEventFlagFailure = 2;
+
+::event_source_t& getFlashEngineEventSource();
+
+}
+}
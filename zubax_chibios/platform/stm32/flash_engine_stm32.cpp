@@ -0,0 +1,268 @@
+/*
+ * Copyright (c) 2026 Zubax, zubax.com
+ * Distributed under the MIT License, available in the file LICENSE.
+ * Author: Pavel Kirienko <pavel.kirienko@zubax.com>
+ */
+
+#include <zubax_chibios/os.hpp>
+#include <hal.h>
+#include "flash_engine.hpp"
+#include "flash_writer.hpp"
+
+/*
+ * Stack size of the flash engine thread; zero disables the engine.
+ */
+#ifndef FLASH_ENGINE_STACK_SIZE
+# define FLASH_ENGINE_STACK_SIZE        0
+#endif
+
+/*
+ * Priority of the FLASH interrupt; the handler is kernel-aware.
+ */
+#ifndef FLASH_ENGINE_IRQ_PRIORITY
+# define FLASH_ENGINE_IRQ_PRIORITY      CORTEX_MINIMUM_PRIORITY
+#endif
+
+#if (FLASH_ENGINE_STACK_SIZE > 0) && !FLASH_WRITER_BOUNDED_LATENCY
+# error "The flash engine requires FLASH_WRITER_BOUNDED_LATENCY"
+#endif
+
+
+namespace os
+{
+namespace stm32
+{
+
+static EVENTSOURCE_DECL(_event_source);
+
+/*
+ * Serializes the execution of the requests; unlike the semaphores, the mutex provides priority inheritance.
+ * The queue is dequeued only holding the mutex, so that the requests are executed in the order of submission
+ * by whichever thread executes them.
+ */
+static chibios_rt::Mutex _mutex;
+
+#if FLASH_ENGINE_STACK_SIZE > 0
+static FlashRequest* _queue_head = nullptr;
+static FlashRequest* _queue_tail = nullptr;
+static bool _running = false;
+static ::tprio_t _engine_priority = 0;
+static BSEMAPHORE_DECL(_queue_semaphore, true);
+static BSEMAPHORE_DECL(_interrupt_semaphore, true);
+
+/**
+ * Invoked by FlashWriter after an erase operation is started with the FLASH interrupt enabled.
+ * The interrupt is also waited with a timeout, in case if it was missed, e.g. because the operation has failed
+ * before it could be started.
+ */
+static void waitForInterrupt()
+{
+    while (FLASH->SR & FLASH_SR_BSY)
+    {
+        (void)chBSemWaitTimeout(&_interrupt_semaphore, TIME_MS2I(10));
+    }
+}
+#endif
+
+namespace _internal
+{
+
+struct FlashEngine
+{
+    /**
+     * The caller must hold the mutex.
+     */
+    static void execute(FlashRequest& request, FlashWriter::EraseCompletionWaiter waiter)
+    {
+#if FLASH_ENGINE_STACK_SIZE > 0
+        chBSemReset(&_interrupt_semaphore, true);       // Drop the stale signals, if any
+#endif
+        FlashWriter writer(waiter);
+        const bool ok = (request.operation_ == FlashRequest::Operation::Program) ?
+                        writer.write(request.where_, request.what_, request.size_) :
+                        writer.erase(request.where_, request.size_);
+
+        // The request may be destroyed by its owner as soon as it is not pending
+        chSysLock();
+        request.result_ = ok ? 0 : -EIO;
+        request.pending_ = false;
+        chBSemSignalI(&request.completion_);
+        chSchRescheduleS();
+        chSysUnlock();
+
+        chEvtBroadcastFlags(&_event_source, ok ? FlashEngineEventFlagSuccess : FlashEngineEventFlagFailure);
+    }
+
+    static void submit(FlashRequest& request)
+    {
+        assert(!request.pending_);
+        {
+            os::CriticalSectionLocker locker;
+            request.pending_ = true;
+            chBSemResetI(&request.completion_, true);
+#if FLASH_ENGINE_STACK_SIZE > 0
+            if (_running)
+            {
+                request.next_ = nullptr;
+                if (_queue_tail != nullptr)
+                {
+                    _queue_tail->next_ = &request;
+                }
+                else
+                {
+                    _queue_head = &request;
+                }
+                _queue_tail = &request;
+                chBSemSignalI(&_queue_semaphore);
+                chSchRescheduleS();
+                return;
+            }
+#endif
+        }
+        os::MutexLocker locker(_mutex);
+        execute(request, nullptr);              // Falling back to synchronous execution
+    }
+
+#if FLASH_ENGINE_STACK_SIZE > 0
+    /**
+     * The caller must hold the mutex.
+     */
+    static FlashRequest* dequeue()
+    {
+        os::CriticalSectionLocker locker;
+        FlashRequest* const request = _queue_head;
+        if (request != nullptr)
+        {
+            _queue_head = request->next_;
+            if (_queue_head == nullptr)
+            {
+                _queue_tail = nullptr;
+            }
+        }
+        return request;
+    }
+
+    /**
+     * Executes the queued requests and then the specified one in the calling thread, see executeFlashRequest().
+     * Returns false if the engine is not running, in which case nothing is done.
+     */
+    static bool executeInCaller(FlashRequest& request)
+    {
+        os::MutexLocker locker(_mutex);
+        {
+            os::CriticalSectionLocker cs_locker;
+            if (!_running)
+            {
+                return false;
+            }
+            assert(!request.pending_);
+            request.pending_ = true;
+            chBSemResetI(&request.completion_, true);
+        }
+
+        while (FlashRequest* const queued = dequeue())
+        {
+            execute(*queued, &waitForInterrupt);
+        }
+        execute(request, &waitForInterrupt);
+        return true;
+    }
+#endif
+};
+
+}
+
+#if FLASH_ENGINE_STACK_SIZE > 0
+static class FlashEngineThread : public chibios_rt::BaseStaticThread<FLASH_ENGINE_STACK_SIZE>
+{
+    void main() override
+    {
+        setName("flash_engine");
+
+        for (;;)
+        {
+            (void)chBSemWait(&_queue_semaphore);
+            for (;;)
+            {
+                // The mutex is released between the requests, so that a higher priority caller can interleave
+                os::MutexLocker locker(_mutex);
+                FlashRequest* const request = _internal::FlashEngine::dequeue();
+                if (request == nullptr)
+                {
+                    break;
+                }
+                _internal::FlashEngine::execute(*request, &waitForInterrupt);
+            }
+        }
+    }
+} _thread;
+#endif
+
+int startFlashEngine(::tprio_t priority)
+{
+#if FLASH_ENGINE_STACK_SIZE > 0
+    ASSERT_ALWAYS(!_running);
+    nvicEnableVector(FLASH_IRQn, FLASH_ENGINE_IRQ_PRIORITY);
+    (void)_thread.start(priority);
+
+    // A request that is being executed synchronously meanwhile holds the mutex, so the engine will wait for it
+    os::CriticalSectionLocker locker;
+    _engine_priority = priority;
+    _running = true;
+    return 0;
+#else
+    (void)priority;
+    return -ENOTSUP;
+#endif
+}
+
+void submitFlashRequest(FlashRequest& request)
+{
+    _internal::FlashEngine::submit(request);
+}
+
+int executeFlashRequest(FlashRequest& request)
+{
+#if FLASH_ENGINE_STACK_SIZE > 0
+    // Waiting for the engine could take indefinitely long if it is preempted by the threads of the intermediate
+    // priorities; _engine_priority is immutable once the engine is running
+    if ((chThdGetPriorityX() > _engine_priority) && _internal::FlashEngine::executeInCaller(request))
+    {
+        return request.wait();                  // Completed already
+    }
+#endif
+    submitFlashRequest(request);
+    return request.wait();
+}
+
+::event_source_t& getFlashEngineEventSource()
+{
+    return _event_source;
+}
+
+}
+}
+
+#if FLASH_ENGINE_STACK_SIZE > 0
+extern "C"
+{
+
+/**
+ * FLASH_IRQn is 4 on all supported MCUs, hence the vector offset 0x50.
+ * The interrupt sources are disabled here, and the flags are cleared by FlashWriter afterwards.
+ */
+CH_IRQ_HANDLER(Vector50)
+{
+    CH_IRQ_PROLOGUE();
+
+    FLASH->CR &= ~(FLASH_CR_EOPIE | FLASH_CR_ERRIE);
+
+    chSysLockFromISR();
+    chBSemSignalI(&os::stm32::_interrupt_semaphore);
+    chSysUnlockFromISR();
+
+    CH_IRQ_EPILOGUE();
+}
+
+}
+#endif
@@ -0,0 +1,166 @@
+/*
+ * Copyright (c) 2026 Zubax, zubax.com
+ * Distributed under the MIT License, available in the file LICENSE.
+ * Author: Pavel Kirienko <pavel.kirienko@zubax.com>
+ */
+
+/*
+ * Layout of the flash memory of the supported MCUs: the erase units (pages or sectors) in the order of addresses.
+ * Everything here is constexpr, so that the storage layouts can be checked and the buffers can be sized at compile
+ * time, e.g.:
+ *
+ *      static_assert(os::stm32::isFlashRegionEraseAligned(ConfigStorageAddress, ConfigStorageSize),
+ *                    "Erasing the config storage would erase the neighbouring data");
+ */
+
+#pragma once
+
+#include <hal.h>
+#include <cstdint>
+#include <cstddef>
+
+/*
+ * The tables below describe the largest density of each MCU family, e.g. STM32F407xx covers the 512 KiB parts
+ * as well as the 1 MiB ones. FLASH_GEOMETRY_SIZE, if defined, limits the geometry to the actual flash size,
+ * so that the regions past the end of the flash are not considered erasable.
+ *
+ * The MCUs that erase by pages (FLASH_CR_PER) and are not listed below are supported only if both
+ * FLASH_GEOMETRY_PAGE_SIZE and FLASH_GEOMETRY_SIZE are defined; their geometry is assumed to be uniform.
+ */
+
+namespace os
+{
+namespace stm32
+{
+/**
+ * A contiguous run of erase units of the same size.
+ */
+struct FlashGeometryRegion
+{
+    std::size_t base;
+    std::size_t unit_size;
+    unsigned num_units;
+
+    constexpr std::size_t getEnd() const { return base + unit_size * num_units; }
+};
+
+/**
+ * The regions are contiguous and ordered by address.
+ */
+static constexpr FlashGeometryRegion FlashGeometry[] =
+{
+#if defined(STM32F105xC) || defined(STM32F107xC) || defined(STM32F37X)
+    { FLASH_BASE,                   2048,       128 },
+#elif defined(STM32F405xx) || defined(STM32F407xx) || defined(STM32F415xx) || defined(STM32F417xx)
+    { FLASH_BASE,                   16 * 1024,  4 },
+    { FLASH_BASE + 0x10000,         64 * 1024,  1 },
+    { FLASH_BASE + 0x20000,         128 * 1024, 7 },
+#elif defined(STM32F446xx)
+    { FLASH_BASE,                   16 * 1024,  4 },
+    { FLASH_BASE + 0x10000,         64 * 1024,  1 },
+    { FLASH_BASE + 0x20000,         128 * 1024, 3 },
+#elif defined(FLASH_CR_PER) && defined(FLASH_GEOMETRY_PAGE_SIZE) && defined(FLASH_GEOMETRY_SIZE)
+    { FLASH_BASE,                   FLASH_GEOMETRY_PAGE_SIZE, FLASH_GEOMETRY_SIZE / FLASH_GEOMETRY_PAGE_SIZE },
+#else
+# error "Flash geometry of this MCU is unknown, define FLASH_GEOMETRY_PAGE_SIZE and FLASH_GEOMETRY_SIZE"
+#endif
+};
+
+/**
+ * The end address of the flash: of the actual one if FLASH_GEOMETRY_SIZE is defined, of the largest density otherwise.
+ */
+static constexpr std::size_t FlashGeometryEnd =
+#if defined(FLASH_GEOMETRY_SIZE)
+    FLASH_BASE + (FLASH_GEOMETRY_SIZE);
+#else
+    FlashGeometry[(sizeof(FlashGeometry) / sizeof(FlashGeometry[0])) - 1].getEnd();
+#endif
+
+/**
+ * An erase unit - a page or a sector; the number counts the units from the beginning of the flash, and it is
+ * the sector number on the MCUs that erase by sectors. The size is zero if there is no such unit.
+ */
+struct FlashEraseUnit
+{
+    std::size_t address = 0;
+    std::size_t size = 0;
+    unsigned number = 0;
+
+    constexpr bool isValid() const { return size > 0; }
+};
+
+constexpr FlashEraseUnit getFlashEraseUnitContaining(const std::size_t address)
+{
+    unsigned number = 0;
+    for (const FlashGeometryRegion& r : FlashGeometry)
+    {
+        if ((address >= r.base) && (address < r.getEnd()) && (address < FlashGeometryEnd))
+        {
+            const unsigned index = unsigned((address - r.base) / r.unit_size);
+            FlashEraseUnit unit;
+            unit.address = r.base + r.unit_size * index;
+            unit.size = r.unit_size;
+            unit.number = number + index;
+            return unit;
+        }
+        number += r.num_units;
+    }
+    return FlashEraseUnit();
+}
+
+/**
+ * Whether the region consists of whole erase units, i.e. whether it can be erased without affecting anything else.
+ */
+constexpr bool isFlashRegionEraseAligned(const std::size_t address, const std::size_t size)
+{
+    return (size > 0) &&
+           (getFlashEraseUnitContaining(address).address == address) &&
+           ((getFlashEraseUnitContaining(address + size - 1U).address +
+             getFlashEraseUnitContaining(address + size - 1U).size) == (address + size));
+}
+
+constexpr std::size_t getFlashSmallestEraseUnitSize()
+{
+    std::size_t out = FlashGeometry[0].unit_size;
+    for (const FlashGeometryRegion& r : FlashGeometry)
+    {
+        out = ((r.unit_size < out) && (r.base < FlashGeometryEnd)) ? r.unit_size : out;
+    }
+    return out;
+}
+
+constexpr std::size_t getFlashLargestEraseUnitSize()
+{
+    std::size_t out = 0;
+    for (const FlashGeometryRegion& r : FlashGeometry)
+    {
+        out = ((r.unit_size > out) && (r.base < FlashGeometryEnd)) ? r.unit_size : out;
+    }
+    return out;
+}
+
+constexpr unsigned getFlashEraseUnitCount()
+{
+    const FlashEraseUnit last = getFlashEraseUnitContaining(FlashGeometryEnd - 1U);
+    return last.isValid() ? (last.number + 1U) : 0U;
+}
+
+constexpr bool isFlashGeometryContiguous()
+{
+    for (std::size_t i = 1; i < (sizeof(FlashGeometry) / sizeof(FlashGeometry[0])); i++)
+    {
+        if (FlashGeometry[i].base != FlashGeometry[i - 1].getEnd())
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static_assert(isFlashGeometryContiguous(), "Invalid flash geometry");
+static_assert((getFlashEraseUnitContaining(FlashGeometryEnd - 1U).address +
+               getFlashEraseUnitContaining(FlashGeometryEnd - 1U).size) == FlashGeometryEnd,
+              "FLASH_GEOMETRY_SIZE must end on an erase unit boundary within the flash geometry");
+
+}
+}
@@ -6,6 +6,7 @@
 
 #pragma once
 
+#include "flash_geometry.hpp"
 #include <ch.hpp>
 #include <hal.h>
 #include <cassert>
@@ -17,6 +18,37 @@
 # define FLASH_SR_WRPRTERR      FLASH_SR_WRPERR
 #endif
 
+/*
+ * On the MCUs that support the program parallelism selection (FLASH_CR_PSIZE), the widest program size is selected
+ * according to the supply voltage STM32_VDD (defined in the board configuration, in units of 10 mV), see the reference
+ * manual, section "Program/erase parallelism". The x64 parallelism requires the external programming voltage on the
+ * VPP pin, so it must be enabled explicitly.
+ */
+#if !defined(FLASH_WRITER_EXTERNAL_VPP)
+# define FLASH_WRITER_EXTERNAL_VPP      0
+#endif
+
+/*
+ * By default, the interrupts are disabled for the entire duration of a write or erase operation.
+ * In the bounded latency mode, the critical sections cover only the register configuration steps and the programming
+ * of one unit (a halfword to a double word, see above), and the thread sleeps while a page or sector is being erased.
+ * Note that the code and data that are fetched from the flash bank being programmed or erased still stall until
+ * the operation is finished; the interrupt handlers that must be served meanwhile should be executed from RAM.
+ * The caller must not call FlashWriter from multiple threads concurrently.
+ */
+#if !defined(FLASH_WRITER_BOUNDED_LATENCY)
+# define FLASH_WRITER_BOUNDED_LATENCY   0
+#endif
+
+/*
+ * The pages that were verified to be blank by FlashWriter::erase() and were not programmed since are remembered,
+ * so that erasing them again costs nothing. The pages are tracked in this amount of memory from the beginning of
+ * the flash, at one bit per page; zero disables the tracking. The flash must not be modified bypassing FlashWriter.
+ */
+#if !defined(FLASH_WRITER_TRACKED_SIZE)
+# define FLASH_WRITER_TRACKED_SIZE      (256 * 1024)
+#endif
+
 namespace os
 {
 namespace stm32
@@ -28,6 +60,26 @@ namespace stm32
  */
 class FlashWriter
 {
+public:
+    /**
+     * See the constructor.
+     */
+    using EraseCompletionWaiter = void (*)();
+
+private:
+    struct NoLocker
+    {
+        NoLocker() { }
+    };
+
+#if FLASH_WRITER_BOUNDED_LATENCY
+    using OperationLocker = NoLocker;
+    using StepLocker = CriticalSectionLocker;
+#else
+    using OperationLocker = CriticalSectionLocker;
+    using StepLocker = NoLocker;
+#endif
+
     static void waitReady()
     {
         do
@@ -45,12 +97,28 @@ class FlashWriter
         FLASH->SR |= FLASH_SR_EOP;
     }
 
+    /**
+     * Waits for the completion of an erase operation; the thread sleeps meanwhile in the bounded latency mode.
+     */
+    static void waitEraseCompletion()
+    {
+#if FLASH_WRITER_BOUNDED_LATENCY
+        while (FLASH->SR & FLASH_SR_BSY)
+        {
+            chThdSleep(1);
+        }
+#endif
+        waitReady();
+    }
+
     struct Prologuer
     {
-        const CriticalSectionLocker locker_;
+        const OperationLocker locker_;
 
         Prologuer()
         {
+            waitEraseCompletion();      // In case if an erase initiated elsewhere is still in progress
+            const StepLocker step_locker;
             waitReady();
             if (FLASH->CR & FLASH_CR_LOCK)
             {
@@ -73,40 +141,170 @@ class FlashWriter
         }
     };
 
+    const EraseCompletionWaiter erase_completion_waiter_;
+
+    std::uint32_t getEraseInterruptEnableBits() const
+    {
+#if FLASH_WRITER_BOUNDED_LATENCY
+        return (erase_completion_waiter_ != nullptr) ? (FLASH_CR_EOPIE | FLASH_CR_ERRIE) : 0;
+#else
+        return 0;
+#endif
+    }
+
+    void waitStartedEraseCompletion() const
+    {
+#if FLASH_WRITER_BOUNDED_LATENCY
+        if (erase_completion_waiter_ != nullptr)
+        {
+            erase_completion_waiter_();
+        }
+#endif
+        waitEraseCompletion();
+    }
+
+#ifdef FLASH_CR_PSIZE_0
+# if defined(STM32_VDD) && (STM32_VDD < 210)
+    static constexpr unsigned MinProgramSize = 1;
+# else
+    static constexpr unsigned MinProgramSize = 2;
+# endif
+# if FLASH_WRITER_EXTERNAL_VPP
+    static constexpr unsigned MaxProgramSize = 8;
+# elif defined(STM32_VDD) && (STM32_VDD < 270)
+    static constexpr unsigned MaxProgramSize = MinProgramSize;
+# else
+    static constexpr unsigned MaxProgramSize = 4;
+# endif
+
+    static std::uint32_t getProgramSizeBits(unsigned size)
+    {
+        switch (size)
+        {
+        case 1:  return 0;
+        case 2:  return FLASH_CR_PSIZE_0;
+        case 4:  return FLASH_CR_PSIZE_1;
+        default: return FLASH_CR_PSIZE_0 | FLASH_CR_PSIZE_1;
+        }
+    }
+#else
+    static constexpr unsigned MinProgramSize = 2;
+    static constexpr unsigned MaxProgramSize = 2;
+#endif
+
     /**
-     * This function maps an arbitrary address onto a flash sector number.
-     * It need not be implemented for MCU which do not require sector numbers for operations on flash.
-     * Returns negative if there's no match.
+     * Checks whether the memory is erased by reading it word by word; stops at the first non-blank word.
      */
-    static int mapAddressToSectorNumber(const std::size_t where)
+    static bool isBlank(std::size_t begin, const std::size_t end)
     {
-        if (where < 0x08000000)
-        {
-            return -1;
-        }
-
-#if defined(STM32F446xx)
-        // 16K
-        if (where <= 0x08003FFF) { return 0; }
-        if (where <= 0x08007FFF) { return 1; }
-        if (where <= 0x0800BFFF) { return 2; }
-        if (where <= 0x0800FFFF) { return 3; }
-        // 64K
-        if (where <= 0x0801FFFF) { return 4; }
-        // 128K
-        if (where <= 0x0803FFFF) { return 5; }
-        if (where <= 0x0805FFFF) { return 6; }
-        if (where <= 0x0807FFFF) { return 7; }
-#else
-        assert(false);
+        for (; (begin < end) && ((begin % 4U) != 0); begin++)
+        {
+            if (*reinterpret_cast<const std::uint8_t*>(begin) != 0xFF)
+            {
+                return false;
+            }
+        }
+        for (; (begin + 4U) <= end; begin += 4U)
+        {
+            if (*reinterpret_cast<const std::uint32_t*>(begin) != 0xFFFFFFFFUL)
+            {
+                return false;
+            }
+        }
+        for (; begin < end; begin++)
+        {
+            if (*reinterpret_cast<const std::uint8_t*>(begin) != 0xFF)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+#if defined(FLASH_CR_PER)
+    static constexpr unsigned NumTrackedPages = FLASH_WRITER_TRACKED_SIZE / getFlashSmallestEraseUnitSize();
+
+    /// One bit per page; set if the page is known to be blank
+    inline static std::uint32_t erased_page_bitmap_[NumTrackedPages / 32U + 1U] = {};
+
+    static bool isPageKnownErased(const FlashEraseUnit& page)
+    {
+        const unsigned index = page.number;
+        return (index < NumTrackedPages) &&
+               ((erased_page_bitmap_[index / 32U] & (1UL << (index % 32U))) != 0);
+    }
+
+    static void setPageKnownErased(const FlashEraseUnit& page, const bool erased)
+    {
+        const unsigned index = page.number;
+        if (index < NumTrackedPages)
+        {
+            if (erased)
+            {
+                erased_page_bitmap_[index / 32U] |= 1UL << (index % 32U);
+            }
+            else
+            {
+                erased_page_bitmap_[index / 32U] &= ~(1UL << (index % 32U));
+            }
+        }
+    }
 #endif
 
-        return -1;
+    /**
+     * Programs one unit of the specified size; the data must be aligned at the size of the unit.
+     */
+    static void programUnit(const std::size_t address, const void* const data, const unsigned size)
+    {
+        switch (size)
+        {
+        case 1:
+        {
+            *reinterpret_cast<volatile std::uint8_t*>(address) = *static_cast<const std::uint8_t*>(data);
+            break;
+        }
+        case 2:
+        {
+            *reinterpret_cast<volatile std::uint16_t*>(address) = *static_cast<const std::uint16_t*>(data);
+            break;
+        }
+        default:
+        {
+            // The double word is programmed by two consecutive word writes
+            const std::uint32_t* const words = static_cast<const std::uint32_t*>(data);
+            for (unsigned i = 0; i < (size / 4U); i++)
+            {
+                reinterpret_cast<volatile std::uint32_t*>(address)[i] = words[i];
+            }
+            break;
+        }
+        }
+        waitReady();
     }
 
 public:
+    /**
+     * In the bounded latency mode, the erase operations can be started with the FLASH interrupt (EOP and errors)
+     * enabled; then the waiter is invoked instead of polling, and it must return once the interrupt has fired.
+     * The interrupt handler must disable the interrupt sources in FLASH->CR. See flash_engine.hpp.
+     */
+    explicit FlashWriter(EraseCompletionWaiter erase_completion_waiter = nullptr) :
+        erase_completion_waiter_(erase_completion_waiter)
+    { }
+
+    /**
+     * Returns the page or sector that would be erased by erase() in order to erase the specified address.
+     * The returned unit is invalid if the address is outside of the flash. See flash_geometry.hpp.
+     */
+    static FlashEraseUnit eraseUnitContaining(const void* const address)
+    {
+        return getFlashEraseUnitContaining(reinterpret_cast<std::size_t>(address));
+    }
+
     /**
      * Source and destination must be aligned at two bytes.
+     * The widest program size permitted by the supply voltage is used where the destination alignment allows;
+     * the unaligned head and tail are programmed by halfwords. An odd trailing byte is padded with 0xFF.
      */
     bool write(const void* const where,
                const void* const what,
@@ -120,24 +318,52 @@ public:
             return false;
         }
 
-        const unsigned num_halfwords = (how_much + 1U) / 2U;
+        const std::size_t address = reinterpret_cast<std::size_t>(where);
+        const std::uint8_t* const source = static_cast<const std::uint8_t*>(what);
 
-        volatile std::uint16_t* flashptr16 = static_cast<std::uint16_t*>(const_cast<void*>(where));
-        const std::uint16_t* ramptr16 = static_cast<const std::uint16_t*>(what);
+#if defined(FLASH_CR_PER)
+        for (FlashEraseUnit page = getFlashEraseUnitContaining(address);
+             page.isValid() && (page.address < (address + how_much));
+             page = getFlashEraseUnitContaining(page.address + page.size))
+        {
+            setPageKnownErased(page, false);
+        }
+#endif
 
         {
             Prologuer prologuer;
 
+            unsigned current_size = 0;
+            std::size_t offset = 0;
+            while (offset < how_much)
+            {
+                const std::size_t remaining = how_much - offset;
+                unsigned size = MaxProgramSize;
+                while ((size > MinProgramSize) && ((((address + offset) % size) != 0) || (remaining < size)))
+                {
+                    size /= 2U;
+                }
+
+                // The source may be misaligned relative to the destination, so the unit is copied
+                std::uint32_t unit[2];
+                std::memset(unit, 0xFF, sizeof(unit));
+                std::memcpy(unit, source + offset, std::min<std::size_t>(remaining, size));
+
+                {
+                    const StepLocker step_locker;
+                    if (size != current_size)
+                    {
+                        current_size = size;
 #ifdef FLASH_CR_PSIZE_0
-            FLASH->CR = FLASH_CR_PG | FLASH_CR_PSIZE_0;
+                        FLASH->CR = FLASH_CR_PG | getProgramSizeBits(size);
 #else
-            FLASH->CR = FLASH_CR_PG;
+                        FLASH->CR = FLASH_CR_PG;
 #endif
+                    }
+                    programUnit(address + offset, unit, size);
+                }
 
-            for (unsigned i = 0; i < num_halfwords; i++)
-            {
-                *flashptr16++ = *ramptr16++;
-                waitReady();
+                offset += size;
             }
 
             waitReady();
@@ -149,72 +375,84 @@ public:
 
     /**
      * Erases the specified region, possibly more if the region does not exactly match with the page/sector boundaries.
+     * On the MCUs that erase by pages, only the pages that are not blank within the region are erased.
      */
     bool erase(const void* const where,
                const std::size_t how_much)
     {
-#if defined(FLASH_CR_PER)
-        for (std::size_t blank_check_pos = reinterpret_cast<std::size_t>(where);
-            blank_check_pos < (reinterpret_cast<std::size_t>(where) + how_much);
-            blank_check_pos++)
+        const std::size_t begin = reinterpret_cast<std::size_t>(where);
+        const std::size_t end = begin + how_much;
+
+        for (std::size_t location = begin; location < end;)
         {
-            if (*reinterpret_cast<const std::uint8_t*>(blank_check_pos) != 0xFF)
+            const FlashEraseUnit unit = getFlashEraseUnitContaining(location);
+            if (!unit.isValid())
             {
-                DEBUG_LOG("Erasing page @ %x... ", blank_check_pos);
+                return false;
+            }
+            location = unit.address + unit.size;
 
-                // Erase operation
-                {
-                    Prologuer prologuer;
-                    FLASH->CR = FLASH_CR_PER;
-                    FLASH->AR = blank_check_pos;
-                    FLASH->CR = FLASH_CR_PER | FLASH_CR_STRT;
-                    waitReady();
-                    FLASH->CR = 0;
-                }
+#if defined(FLASH_CR_PER)
+            // Each page is checked only within the region; the data outside of the region does not trigger erasure
+            if (isPageKnownErased(unit))
+            {
+                continue;
+            }
 
-                // Immediate blank check
-                if (*reinterpret_cast<const std::uint8_t*>(blank_check_pos) != 0xFF)
+            const std::size_t check_begin = std::max(unit.address, begin);
+            const std::size_t check_end = std::min(unit.address + unit.size, end);
+            if (isBlank(check_begin, check_end))
+            {
+                if ((check_begin == unit.address) && (check_end == (unit.address + unit.size)))
                 {
-                    // Interrupt immediately, otherwise we'll be stuck here erasing each byte unsuccessfully
-                    DEBUG_LOG("Page erase FAILED\n");
-                    return false;
+                    setPageKnownErased(unit, true);
                 }
-
-                DEBUG_LOG("Page erase OK\n");
+                continue;
             }
-        }
-#else
-        constexpr unsigned SmallestSectorSize = 1024;
 
-        int sector_number = -1;
+            DEBUG_LOG("Erasing page @ %x... ", unsigned(unit.address));
 
-        for (std::size_t location = reinterpret_cast<std::size_t>(where);
-             location < (reinterpret_cast<std::size_t>(where) + how_much);
-             location += SmallestSectorSize)
-        {
-            const int new_sector_number = mapAddressToSectorNumber(location);
-            if (new_sector_number < 0)
+            // Erase operation
             {
-                return false;
+                Prologuer prologuer;
+                {
+                    const StepLocker step_locker;
+                    FLASH->CR = FLASH_CR_PER;
+                    FLASH->AR = unit.address;
+                    FLASH->CR = FLASH_CR_PER | FLASH_CR_STRT | getEraseInterruptEnableBits();
+                }
+                waitStartedEraseCompletion();
+                FLASH->CR = 0;
             }
-            if (new_sector_number == sector_number)
+
+            // Immediate blank check of the entire page
+            if (!isBlank(unit.address, unit.address + unit.size))
             {
-                continue;
+                DEBUG_LOG("Page erase FAILED\n");
+                return false;
             }
-            sector_number = new_sector_number;
-            DEBUG_LOG("Erasing at 0x%08x, sector %d\n", unsigned(location), sector_number);
+
+            setPageKnownErased(unit, true);
+            DEBUG_LOG("Page erase OK\n");
+#else
+            DEBUG_LOG("Erasing at 0x%08x, sector %u\n", unsigned(unit.address), unit.number);
 
             Prologuer prologuer;
-            FLASH->CR = FLASH_CR_SER | (sector_number << 3);
-            FLASH->CR |= FLASH_CR_STRT;
-            waitReady();
+            {
+                const StepLocker step_locker;
+                FLASH->CR = FLASH_CR_SER | (unit.number << 3) | getEraseInterruptEnableBits();
+                FLASH->CR |= FLASH_CR_STRT;
+            }
+            waitStartedEraseCompletion();
             FLASH->CR = 0;
-        }
 #endif
+        }
 
-        return std::all_of(reinterpret_cast<const std::uint8_t*>(where),
-                           reinterpret_cast<const std::uint8_t*>(where) + how_much,
-                           [](std::uint8_t x) { return x == 0xFF; });
+#if defined(FLASH_CR_PER)
+        return true;            // Every page was verified above
+#else
+        return isBlank(begin, end);
+#endif
     }
 };
 
@@ -51,15 +51,30 @@ void sleepUntilChTime(systime_t sleep_until)
 }
 
 static bool reboot_request_flag = false;
+static bool reboot_ready_flag = false;          ///< Latched result of the reboot preparation hook
+static RebootPreparationHook reboot_preparation_hook;
+
+void setRebootPreparationHook(const RebootPreparationHook& hook)
+{
+    reboot_preparation_hook = hook;
+}
 
 void requestReboot()
 {
     reboot_request_flag = true;
+    if (reboot_preparation_hook)
+    {
+        (void)reboot_preparation_hook();
+    }
 }
 
 bool isRebootRequested()
 {
-    return reboot_request_flag;
+    if (reboot_request_flag && !reboot_ready_flag)
+    {
+        reboot_ready_flag = !reboot_preparation_hook || reboot_preparation_hook();
+    }
+    return reboot_ready_flag;
 }
 
 } // namespace os
@@ -97,12 +97,31 @@ extern void applicationHaltHook(void);
 void sleepUntilChTime(systime_t sleep_until);
 
 /**
- * After this function is invoked, @ref isRebootRequested() will be returning true.
+ * This delegate allows a component to complete its work before the application reboots, e.g. to flush pending
+ * writes into the non-volatile memory. It is invoked from @ref requestReboot() to let the component know that
+ * the reboot is imminent, and then from @ref isRebootRequested() until it returns true, which means that the
+ * component is ready; after that, it is not invoked anymore. The delegate is invoked in the context of the caller
+ * of these functions. Normally, the delegate should never block.
+ * @ref setRebootPreparationHook().
+ */
+using RebootPreparationHook = std::function<bool ()>;
+
+/**
+ * Assigns the reboot preparation hook; there can be only one. Assign an empty function to remove it.
+ * This function is not thread safe, it should be invoked during the initialization only.
+ */
+void setRebootPreparationHook(const RebootPreparationHook& hook);
+
+/**
+ * After this function is invoked, @ref isRebootRequested() will be returning true,
+ * unless the reboot preparation hook reports that the system is not yet ready to reboot.
+ * This function invokes the reboot preparation hook, so it must be invoked from a thread, not from an ISR.
  */
 void requestReboot();
 
 /**
  * Returns true if the application must reboot.
+ * This function may invoke the reboot preparation hook, so the same restriction applies as to @ref requestReboot().
  */
 bool isRebootRequested();
 